@@ -2,16 +2,113 @@
 #define CUBE_H
 
 #include <GL/glew.h>
+#include <algorithm>
+#include <cmath>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <vector>
 
+// One level of detail of a generated mesh: a range of its index buffer
+struct MeshLod {
+  int segments;
+  int firstIndex;
+  int indexCount;
+};
+
+// Per-part vertex attributes of a batched draw, locations 2-7 in
+// shaders.glsl (the model matrix takes one location per column)
+struct InstanceData {
+  glm::mat4 model;
+  glm::vec3 color;
+  float glows; // 1 if the part lights up with its viewport's emissive bit
+};
+
+// The parts of one mesh queued for a frame. They go to the GPU in one
+// instance buffer and are drawn with one glDrawElementsInstanced per LOD.
+// Each part is repeated for `copies` consecutive instances (the attribute
+// divisor), so the same call also covers every viewport of the quad view.
+class InstanceBatch {
+public:
+  unsigned int VBO = 0;
+
+  // Called with the mesh's VAO bound
+  void init(int lodCount) {
+    lods.resize(lodCount);
+    first.resize(lodCount);
+    glGenBuffers(1, &VBO);
+    for (int i = 0; i < 6; i++)
+      glEnableVertexAttribArray(2 + i);
+  }
+
+  void clear() {
+    for (size_t i = 0; i < lods.size(); i++)
+      lods[i].clear();
+  }
+
+  void add(int lod, const InstanceData &instance) {
+    lods[lod].push_back(instance);
+  }
+
+  // Every LOD's parts back to back, in one glBufferData
+  void upload() {
+    packed.clear();
+    for (size_t i = 0; i < lods.size(); i++) {
+      first[i] = packed.size();
+      packed.insert(packed.end(), lods[i].begin(), lods[i].end());
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glBufferData(GL_ARRAY_BUFFER, packed.size() * sizeof(InstanceData),
+                 packed.empty() ? NULL : &packed[0], GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+
+  // Draw what was last uploaded, ranges[i] being LOD i of the mesh in VAO.
+  // Returns the number of draw calls made.
+  int draw(unsigned int VAO, const MeshLod *ranges, int copies) const {
+    int draws = 0;
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    for (size_t i = 0; i < lods.size(); i++) {
+      if (lods[i].empty())
+        continue;
+      pointAttributes(first[i], copies);
+      glDrawElementsInstanced(
+          GL_TRIANGLES, ranges[i].indexCount, GL_UNSIGNED_INT,
+          (void *)(ranges[i].firstIndex * sizeof(unsigned int)),
+          (int)lods[i].size() * copies);
+      draws++;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return draws;
+  }
+
+private:
+  std::vector<std::vector<InstanceData> > lods;
+  std::vector<size_t> first; // of each LOD in the instance buffer
+  std::vector<InstanceData> packed;
+
+  // Instance attributes starting at firstInstance, with the buffer bound
+  static void pointAttributes(size_t firstInstance, int copies) {
+    size_t base = firstInstance * sizeof(InstanceData);
+    GLsizei stride = sizeof(InstanceData);
+    for (int c = 0; c < 4; c++)
+      glVertexAttribPointer(2 + c, 4, GL_FLOAT, GL_FALSE, stride,
+                            (void *)(base + c * sizeof(glm::vec4)));
+    glVertexAttribPointer(6, 3, GL_FLOAT, GL_FALSE, stride,
+                          (void *)(base + sizeof(glm::mat4)));
+    glVertexAttribPointer(
+        7, 1, GL_FLOAT, GL_FALSE, stride,
+        (void *)(base + sizeof(glm::mat4) + sizeof(glm::vec3)));
+    for (int i = 0; i < 6; i++)
+      glVertexAttribDivisor(2 + i, copies);
+  }
+};
+
 class Cube {
 public:
   unsigned int VAO, VBO, EBO;
-  glm::vec3 color;
 
-  Cube(glm::vec3 c = glm::vec3(1.0f, 1.0f, 1.0f)) : color(c) {
+  Cube() {
     float vertices[] = {// positions          // normals
                         -0.5f, -0.5f, -0.5f, 0.0f,  0.0f,  -1.0f, 0.5f,  -0.5f,
                         -0.5f, 0.0f,  0.0f,  -1.0f, 0.5f,  0.5f,  -0.5f, 0.0f,
@@ -62,33 +159,121 @@ public:
     glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float),
                           (void *)(3 * sizeof(float)));
     glEnableVertexAttribArray(1);
+    batch.init(1);
   }
 
-  void draw(unsigned int shaderProgram, glm::mat4 model) {
-    glUseProgram(shaderProgram);
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "model"), 1,
-                       GL_FALSE, &model[0][0]);
-    glUniform3fv(glGetUniformLocation(shaderProgram, "color"), 1, &color[0]);
-    glBindVertexArray(VAO);
-    glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+  // Queue a cube for this frame's batch, drawn by upload() + draw()
+  void add(const glm::mat4 &model, glm::vec3 partColor, bool glows = false) {
+    InstanceData instance = {model, partColor, glows ? 1.0f : 0.0f};
+    batch.add(0, instance);
+  }
+
+  void clear() { batch.clear(); }
+  void upload() { batch.upload(); }
+
+  // Every queued cube, each `copies` times (see viewportCount in
+  // shaders.glsl), in one draw call
+  int draw(int copies) const {
+    static const MeshLod whole = {0, 0, 36};
+    return batch.draw(VAO, &whole, copies);
   }
+
+private:
+  InstanceBatch batch;
 };
 
-#include <cmath>
+// Diameter in pixels of a bounding sphere of localRadius around the model
+// origin. projScale is projection[1][1] * viewport height / 2.
+inline float projectedDiameter(const glm::mat4 &model, float localRadius,
+                               const glm::mat4 &view, float projScale) {
+  float scale = std::max(glm::length(glm::vec3(model[0])),
+                         std::max(glm::length(glm::vec3(model[1])),
+                                  glm::length(glm::vec3(model[2]))));
+  float depth = -(view * model[3]).z;
+  if (depth <= 0.0f)
+    return 0.0f;
+  return 2.0f * localRadius * scale * projScale / depth;
+}
+
+// Coarsest LOD whose silhouette stays within half a pixel of the true circle
+// (a chord over 2*pi/n of a circle of r pixels sags by r * (pi/n)^2 / 2)
+inline int selectLod(const std::vector<MeshLod> &lods, float pixels) {
+  float needed = 3.14159f * std::sqrt(std::max(pixels, 0.0f) * 0.5f);
+  for (int i = (int)lods.size() - 1; i > 0; i--)
+    if ((float)lods[i].segments >= needed)
+      return i;
+  return 0;
+}
 
+// 0.5-radius UV sphere. Every LOD (segments, segments / 2, ...) lives in one
+// VBO/EBO pair and is picked per draw by index range.
 class Sphere {
 public:
   unsigned int VAO, VBO, EBO;
-  glm::vec3 color;
-  int indexCount;
+  std::vector<MeshLod> lods;
 
-  Sphere(glm::vec3 c = glm::vec3(1.0f, 1.0f, 1.0f)) : color(c) {
+  Sphere(int segments = 20, int lodCount = 3) {
     std::vector<float> vertices;
     std::vector<unsigned int> indices;
 
-    const unsigned int X_SEGMENTS = 20;
-    const unsigned int Y_SEGMENTS = 20;
+    for (int i = 0; i < lodCount; i++) {
+      int lodSegments = std::max(6, segments >> i);
+      if (i > 0 && lodSegments == lods.back().segments)
+        break;
+      lods.push_back(generate(vertices, indices, lodSegments));
+    }
+
+    glGenVertexArrays(1, &VAO);
+    glGenBuffers(1, &VBO);
+    glGenBuffers(1, &EBO);
+
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), &vertices[0],
+                 GL_STATIC_DRAW);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int),
+                 &indices[0], GL_STATIC_DRAW);
+
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float),
+                          (void *)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float),
+                          (void *)(3 * sizeof(float)));
+    glEnableVertexAttribArray(1);
+    batch.init(lods.size());
+  }
+
+  int selectLod(float pixels) const { return ::selectLod(lods, pixels); }
+
+  // Queue a sphere at the given LOD for this frame's batch
+  void add(const glm::mat4 &model, glm::vec3 partColor, int lod,
+           bool glows = false) {
+    InstanceData instance = {model, partColor, glows ? 1.0f : 0.0f};
+    batch.add(lod, instance);
+  }
+
+  void clear() { batch.clear(); }
+  void upload() { batch.upload(); }
+
+  // Every queued sphere, each `copies` times, in one draw call per LOD used
+  int draw(int copies) const { return batch.draw(VAO, &lods[0], copies); }
+
+private:
+  InstanceBatch batch;
+
+  // Append a segments x segments latitude/longitude grid
+  static MeshLod generate(std::vector<float> &vertices,
+                          std::vector<unsigned int> &indices,
+                          int segments) {
+    const unsigned int X_SEGMENTS = segments;
+    const unsigned int Y_SEGMENTS = segments;
     const float PI = 3.14159265359f;
+    unsigned int base = vertices.size() / 6;
+    MeshLod lod;
+    lod.segments = segments;
+    lod.firstIndex = indices.size();
 
     for (unsigned int x = 0; x <= X_SEGMENTS; ++x) {
       for (unsigned int y = 0; y <= Y_SEGMENTS; ++y) {
@@ -109,46 +294,18 @@ public:
 
     for (unsigned int y = 0; y < Y_SEGMENTS; ++y) {
       for (unsigned int x = 0; x < X_SEGMENTS; ++x) {
-        indices.push_back((y + 1) * (X_SEGMENTS + 1) + x);
-        indices.push_back(y * (X_SEGMENTS + 1) + x);
-        indices.push_back(y * (X_SEGMENTS + 1) + x + 1);
+        indices.push_back(base + (y + 1) * (X_SEGMENTS + 1) + x);
+        indices.push_back(base + y * (X_SEGMENTS + 1) + x);
+        indices.push_back(base + y * (X_SEGMENTS + 1) + x + 1);
 
-        indices.push_back((y + 1) * (X_SEGMENTS + 1) + x);
-        indices.push_back(y * (X_SEGMENTS + 1) + x + 1);
-        indices.push_back((y + 1) * (X_SEGMENTS + 1) + x + 1);
+        indices.push_back(base + (y + 1) * (X_SEGMENTS + 1) + x);
+        indices.push_back(base + y * (X_SEGMENTS + 1) + x + 1);
+        indices.push_back(base + (y + 1) * (X_SEGMENTS + 1) + x + 1);
       }
     }
 
-    indexCount = indices.size();
-
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
-    glGenBuffers(1, &EBO);
-
-    glBindVertexArray(VAO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), &vertices[0],
-                 GL_STATIC_DRAW);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int),
-                 &indices[0], GL_STATIC_DRAW);
-
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float),
-                          (void *)0);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float),
-                          (void *)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
-  }
-
-  void draw(unsigned int shaderProgram, glm::mat4 model) {
-    glUseProgram(shaderProgram);
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "model"), 1,
-                       GL_FALSE, &model[0][0]);
-    glUniform3fv(glGetUniformLocation(shaderProgram, "color"), 1, &color[0]);
-    glBindVertexArray(VAO);
-    glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
+    lod.indexCount = indices.size() - lod.firstIndex;
+    return lod;
   }
 };
 
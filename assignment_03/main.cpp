@@ -1,10 +1,18 @@
 #include "cube.h"
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
+#include "headless.h"
+#include "model_file.h"
+#include "profiler.h"
+#include "scene_graph.h"
+#include "viewport_buffer.h"
+#include <algorithm>
 #include <fstream>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <iostream>
+#include <map>
+#include <memory>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -55,6 +63,89 @@ struct ViewportState {
 
 ViewportState viewports[4]; // 0: TL, 1: TR, 2: BL, 3: BR
 
+// Draw all four viewports in one pass, each draw instanced once per viewport
+// (needs GL_ARB_viewport_array; V toggles back to one pass per viewport)
+bool singlePass = true;
+
+// Bits of a viewport's lighting mask (LIGHT_* in shaders.glsl)
+enum LightingBit {
+  LIGHT_DIR = 1 << 0,
+  LIGHT_POINT = 1 << 1,
+  LIGHT_SPOT = 1 << 2,
+  LIGHT_AMBIENT = 1 << 3,
+  LIGHT_DIFFUSE = 1 << 4,
+  LIGHT_SPECULAR = 1 << 5,
+  LIGHT_EMISSIVE = 1 << 6
+};
+
+// Lighting Configuration per Viewport (Strict Compliance), packed for the
+// Viewports uniform block
+int viewportLighting(int i) {
+  bool locDir = dirLightOn;
+  bool locPoint = pointLightOn;
+  bool locSpot = spotLightOn;
+  bool locAmb = ambientOn;
+  bool locDiff = diffuseOn;
+  bool locSpec = specularOn;
+
+  // Emissive (Bulb Glow) linked to Point Light (Interior Light)
+  // "Interior light and emissive bulbs should be the same thing"
+  bool locEmit = pointLightOn;
+
+  // TL (Combined): Use global state (already set)
+
+  // TR (Ambient Only): Force Ambient ON, others OFF
+  if (i == 1) {
+    locDir = true;
+    locPoint = false;
+    locSpot = false;
+    locAmb = true;
+    locDiff = false;
+    locSpec = false;
+    locEmit = false; // Linked to Point Light
+  }
+  // BL (Diffuse Only): Force Diffuse ON, others OFF
+  if (i == 2) {
+    locDir = true;
+    locPoint = false;
+    locSpot = false;
+    locAmb = false;
+    locDiff = true;
+    locSpec = false;
+    locEmit = false; // Linked to Point Light
+  }
+  // BR (Inside View): Directional Lighting + User Controls
+  if (i == 3) {
+    locDir = true;
+    locPoint = pointLightOn; // Allow toggling
+    locSpot = false;
+    locAmb = ambientOn;
+    locDiff = true;
+    locSpec = true;
+    locEmit = pointLightOn; // Linked to Point Light
+  }
+
+  return (locDir ? LIGHT_DIR : 0) | (locPoint ? LIGHT_POINT : 0) |
+         (locSpot ? LIGHT_SPOT : 0) | (locAmb ? LIGHT_AMBIENT : 0) |
+         (locDiff ? LIGHT_DIFFUSE : 0) | (locSpec ? LIGHT_SPECULAR : 0) |
+         (locEmit ? LIGHT_EMISSIVE : 0);
+}
+
+// Camera of each viewport this frame, for picking sphere LODs by projected
+// size (projScale is projection[1][1] * viewport height / 2)
+glm::mat4 viewportViews[4];
+float viewportProjScales[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+
+// Sphere LOD for model as seen from the viewport where it is largest, as one
+// draw list serves all four
+int sphereLod(const Sphere &sphere, const glm::mat4 &model) {
+  float pixels = 0.0f;
+  for (int i = 0; i < 4; i++)
+    pixels = std::max(pixels, projectedDiameter(model, 0.5f, viewportViews[i],
+                                                viewportProjScales[i]));
+  return sphere.selectLod(pixels);
+}
+
 // Custom lookAt function
 glm::mat4 myLookAt(glm::vec3 position, glm::vec3 target, glm::vec3 worldUp) {
   glm::vec3 zaxis = glm::normalize(position - target);
@@ -224,6 +315,15 @@ void processInput(GLFWwindow *window) {
     }
   } else
     iPressed = false;
+
+  static bool vPressed = false;
+  if (glfwGetKey(window, GLFW_KEY_V) == GLFW_PRESS) {
+    if (!vPressed) {
+      singlePass = !singlePass;
+      vPressed = true;
+    }
+  } else
+    vPressed = false;
 }
 
 std::string readShaderCode(const char *filePath) {
@@ -242,6 +342,72 @@ std::string readShaderCode(const char *filePath) {
   }
 }
 
+// Sections of shaders.glsl: vertex, fragment, then the geometry shader of
+// the single-pass quad view
+std::vector<std::string> splitShaderSource(const std::string &content) {
+  const std::string marker = "// <!-- split -->";
+  std::vector<std::string> sections;
+  size_t start = 0, splitPos;
+  while ((splitPos = content.find(marker, start)) != std::string::npos) {
+    sections.push_back(content.substr(start, splitPos - start));
+    start = splitPos + marker.size();
+  }
+  sections.push_back(content.substr(start));
+  return sections;
+}
+
+unsigned int compileShader(GLenum type, const std::string &source,
+                           const char *stage) {
+  const char *code = source.c_str();
+  unsigned int shader = glCreateShader(type);
+  glShaderSource(shader, 1, &code, NULL);
+  glCompileShader(shader);
+  int success;
+  char infoLog[512];
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+  if (!success) {
+    glGetShaderInfoLog(shader, 512, NULL, infoLog);
+    std::cout << "ERROR::SHADER::" << stage << "::COMPILATION_FAILED\n"
+              << infoLog << std::endl;
+  }
+  return shader;
+}
+
+// Vertex + fragment program, with a geometry stage if geometryCode is not
+// empty. Returns 0 if it fails to link.
+unsigned int buildProgram(const std::string &vertexCode,
+                          const std::string &fragmentCode,
+                          const std::string &geometryCode) {
+  unsigned int shaders[3];
+  int count = 0;
+  shaders[count++] = compileShader(GL_VERTEX_SHADER, vertexCode, "VERTEX");
+  shaders[count++] =
+      compileShader(GL_FRAGMENT_SHADER, fragmentCode, "FRAGMENT");
+  if (!geometryCode.empty())
+    shaders[count++] =
+        compileShader(GL_GEOMETRY_SHADER, geometryCode, "GEOMETRY");
+
+  unsigned int program = glCreateProgram();
+  for (int i = 0; i < count; i++)
+    glAttachShader(program, shaders[i]);
+  glLinkProgram(program);
+  int success;
+  char infoLog[512];
+  glGetProgramiv(program, GL_LINK_STATUS, &success);
+  if (!success) {
+    glGetProgramInfoLog(program, 512, NULL, infoLog);
+    std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n"
+              << infoLog << std::endl;
+  }
+  for (int i = 0; i < count; i++)
+    glDeleteShader(shaders[i]);
+  if (!success) {
+    glDeleteProgram(program);
+    return 0;
+  }
+  return program;
+}
+
 glm::mat4 GetViewMatrix(CameraMode mode) {
   switch (mode) {
   case CAM_ISO: {
@@ -284,202 +450,300 @@ glm::mat4 GetViewMatrix(CameraMode mode) {
   return glm::mat4(1.0f);
 }
 
-void renderScene(unsigned int shaderProgram, Cube &busBody, Sphere &wheel,
-                 Cube &windowPane, Cube &door, Cube &windshield,
-                 bool isEmissiveOn) {
-  // --- STATIC ENVIRONMENT (ROAD) ---
-  // Drawn first, unaffected by bus position
-  glm::mat4 roadModel = glm::mat4(1.0f);
-  roadModel = glm::translate(roadModel, glm::vec3(0.0f, -1.0f, 0.0f));
-  roadModel = glm::scale(roadModel, glm::vec3(200.0f, 0.1f, 200.0f));
-  glUniform3fv(glGetUniformLocation(shaderProgram, "objectColor"), 1,
-               &glm::vec3(0.2f, 0.2f, 0.2f)[0]); // Dark asphalt
-  busBody.draw(shaderProgram, roadModel);
-  // --- END ROAD ---
-
-  // Model Matrix
-  glm::mat4 model = glm::mat4(1.0f);
-  model = glm::translate(model, busPos);
-  model = glm::rotate(model, glm::radians(busYaw), glm::vec3(0, 1, 0));
-
-  // Colors
-  glm::vec3 bodyColor(0.8f, 0.8f, 0.8f);
-  glm::vec3 windowColor(0.0f, 0.5f, 0.8f);
-  glm::vec3 tireColor(0.1f, 0.1f, 0.1f);
-  glm::vec3 doorColor(0.5f, 0.3f, 0.1f);
-  glm::vec3 seatColor(0.2f, 0.2f, 0.8f);
-
-  // --- INTERIOR LIGHT BULBS ---
-  // Drawn relative to bus so they move with it (using global PointLightOffsets)
-
-  // Temporarily enable emissive for bulbs so they glow
-  glUniform1i(glGetUniformLocation(shaderProgram, "emissiveOn"), true);
-  glUniform3fv(glGetUniformLocation(shaderProgram, "objectColor"), 1,
-               &glm::vec3(1.0f, 0.9f, 0.6f)[0]);
+// Road and bus parts (see model_file.h for the format)
+const char *SCENE_MODEL_PATH = "scene.model";
 
-  for (int i = 0; i < 4; i++) {
-    // 1. Fixture (Stem) - Non-emissive
-    glUniform1i(glGetUniformLocation(shaderProgram, "emissiveOn"), false);
-    glUniform3fv(glGetUniformLocation(shaderProgram, "objectColor"), 1,
-                 &glm::vec3(0.2f, 0.2f, 0.2f)[0]); // Dark Metal
-    glm::mat4 fixtureM = glm::translate(
-        model, glm::vec3(pointLightOffsets[i].x, 0.65f,
-                         pointLightOffsets[i].z)); // Start slightly above bulb
-    fixtureM = glm::scale(fixtureM, glm::vec3(0.02f, 0.1f, 0.02f)); // Thin stem
-    busBody.draw(shaderProgram, fixtureM);
-
-    // 2. Bulb (Sphere) - Standard Emission
-    // Toggleable by Key 4 (passed as isEmissiveOn)
-    glUniform1i(glGetUniformLocation(shaderProgram, "emissiveOn"),
-                isEmissiveOn);
-    glUniform3fv(glGetUniformLocation(shaderProgram, "objectColor"), 1,
-                 &glm::vec3(1.0f, 0.9f, 0.7f)[0]);
-
-    glm::mat4 bulbM = glm::translate(model, pointLightOffsets[i]);
-    bulbM = glm::scale(bulbM, glm::vec3(0.08f, 0.08f, 0.08f)); // Small sphere
-    wheel.draw(shaderProgram, bulbM);
-  }
-  // Turn back off for safety
-  glUniform1i(glGetUniformLocation(shaderProgram, "emissiveOn"), false);
-
-  // --- HOLLOW BUS BODY CONSTRUCTION ---
-
-  // 1. Floor
-  glm::mat4 floorM = glm::translate(model, glm::vec3(0.0f, -0.7f, 0.0f));
-  floorM = glm::scale(floorM, glm::vec3(2.0f, 0.1f, 5.0f));
-  glUniform3fv(glGetUniformLocation(shaderProgram, "objectColor"), 1,
-               &bodyColor[0]);
-  busBody.draw(shaderProgram, floorM);
-
-  // 2. Roof
-  glm::mat4 roofM = glm::translate(model, glm::vec3(0.0f, 0.7f, 0.0f));
-  roofM = glm::scale(roofM, glm::vec3(2.0f, 0.1f, 5.0f));
-  busBody.draw(shaderProgram, roofM);
-
-  // 3. Lower Side Walls (below windows)
-  // Left Wall Lower
-  glm::mat4 lwM = glm::translate(model, glm::vec3(-0.95f, -0.35f, 0.0f));
-  lwM = glm::scale(lwM, glm::vec3(0.1f, 0.6f, 5.0f));
-  busBody.draw(shaderProgram, lwM);
-  // Right Wall Lower (with gap for door)
-  // Front part
-  glm::mat4 rwM1 = glm::translate(model, glm::vec3(0.95f, -0.35f, -1.0f));
-  rwM1 = glm::scale(rwM1, glm::vec3(0.1f, 0.6f, 3.0f));
-  busBody.draw(shaderProgram, rwM1);
-  // Back part
-  glm::mat4 rwM2 = glm::translate(model, glm::vec3(0.95f, -0.35f, 2.0f));
-  rwM2 = glm::scale(rwM2, glm::vec3(0.1f, 0.6f, 1.0f));
-  busBody.draw(shaderProgram, rwM2);
-
-  // 4. Upper Structure (Pillars between windows) - Simplified as thin vertical
-  // strips
-  for (int i = 0; i < 4; i++) {
-    float z = -2.0f + i * 1.5f;
-    glm::mat4 pM = glm::translate(model, glm::vec3(-0.95f, 0.2f, z));
-    pM = glm::scale(pM, glm::vec3(0.1f, 0.9f, 0.1f));
-    busBody.draw(shaderProgram, pM);
-    pM = glm::translate(model, glm::vec3(0.95f, 0.2f, z));
-    pM = glm::scale(pM, glm::vec3(0.1f, 0.9f, 0.1f));
-    busBody.draw(shaderProgram, pM);
-  }
+// A drawn part of the scene graph: the node it hangs from and its look
+struct ScenePart {
+  int node;
+  bool sphere; // else a cube
+  glm::vec3 color;
+  bool glows; // emissive when the viewport has emissive on
+};
 
-  // 5. Front/Back Walls
-  // Front
-  glm::mat4 fwM = glm::translate(model, glm::vec3(0.0f, 0.0f, 2.45f));
-  fwM = glm::scale(fwM, glm::vec3(2.0f, 1.5f, 0.1f));
-  busBody.draw(shaderProgram, fwM);
-  // Back
-  glm::mat4 bwM = glm::translate(model, glm::vec3(0.0f, 0.0f, -2.45f));
-  bwM = glm::scale(bwM, glm::vec3(2.0f, 1.5f, 0.1f));
-  busBody.draw(shaderProgram, bwM);
-
-  // --- INTERIOR SEATS ---
-  glUniform3fv(glGetUniformLocation(shaderProgram, "objectColor"), 1,
-               &seatColor[0]);
-  for (int i = 0; i < 4; i++) {
-    // Left Row
-    glm::mat4 seatL =
-        glm::translate(model, glm::vec3(-0.6f, -0.4f, -1.5f + i * 0.8f));
-    seatL = glm::scale(seatL, glm::vec3(0.5f, 0.1f, 0.5f)); // Simple seat squab
-    busBody.draw(shaderProgram, seatL);
-    glm::mat4 backL =
-        glm::translate(model, glm::vec3(-0.6f, -0.1f, -1.7f + i * 0.8f));
-    backL = glm::scale(backL, glm::vec3(0.5f, 0.5f, 0.1f)); // Seat back
-    busBody.draw(shaderProgram, backL);
-
-    // Right Row
-    glm::mat4 seatR =
-        glm::translate(model, glm::vec3(0.6f, -0.4f, -1.5f + i * 0.8f));
-    seatR = glm::scale(seatR, glm::vec3(0.5f, 0.1f, 0.5f));
-    busBody.draw(shaderProgram, seatR);
-    glm::mat4 backR =
-        glm::translate(model, glm::vec3(0.6f, -0.1f, -1.7f + i * 0.8f));
-    backR = glm::scale(backR, glm::vec3(0.5f, 0.5f, 0.1f));
-    busBody.draw(shaderProgram, backR);
-  }
+// The scene's model, the channels that pose the bus, and the channel values
+// the graph was last posed from
+struct BusRig {
+  Model model;
+  int busX, busY, busZ, busYaw, door, window;
+  std::vector<float> channels, posed;
+};
 
-  // Windshield (Front Glass) - Adjusted position
-  glm::mat4 wSM = glm::translate(model, glm::vec3(0.0f, 0.3f, 2.51f));
-  wSM = glm::scale(wSM, glm::vec3(1.8f, 0.8f, 0.05f));
-  glUniform3fv(glGetUniformLocation(shaderProgram, "objectColor"), 1,
-               &glm::vec3(0.0f, 0.7f, 0.9f)[0]);
-  windshield.draw(shaderProgram, wSM);
-
-  // Wheels
-  glm::vec3 wheelSpecs[] = {
-      glm::vec3(-1.1f, -0.75f, 2.0f), glm::vec3(1.1f, -0.75f, 2.0f),
-      glm::vec3(-1.1f, -0.75f, -2.0f), glm::vec3(1.1f, -0.75f, -2.0f)};
-  glUniform3fv(glGetUniformLocation(shaderProgram, "objectColor"), 1,
-               &tireColor[0]);
-  for (int i = 0; i < 4; i++) {
-    glm::mat4 wM = glm::translate(model, wheelSpecs[i]);
-    wM = glm::rotate(wM, glm::radians(90.0f),
-                     glm::vec3(0.0f, 0.0f, 1.0f)); // Rotate to face outward
-    wM = glm::scale(wM, glm::vec3(0.6f, 0.3f, 0.6f));
-    wheel.draw(shaderProgram, wM);
+// Channels the model does not use come back from Model::channel as -1 and
+// are ignored here
+void setChannel(BusRig &rig, int channel, float value) {
+  if (channel >= 0)
+    rig.channels[channel] = value;
+}
+
+void setBusChannels(BusRig &rig) {
+  setChannel(rig, rig.busX, busPos.x);
+  setChannel(rig, rig.busY, busPos.y);
+  setChannel(rig, rig.busZ, busPos.z);
+  setChannel(rig, rig.busYaw, busYaw);
+  setChannel(rig, rig.door, doorOpen);
+  setChannel(rig, rig.window, windowOpen);
+}
+
+// Load the road and bus hierarchy, once, into a graph with one node per
+// model part in the same order. Only nodes with animation channels (the bus
+// body, door and window panes) are ever re-posed.
+bool buildScene(const char *path, SceneGraph &graph,
+                std::vector<ScenePart> &parts, BusRig &rig) {
+  if (!rig.model.load(path))
+    return false;
+  const Model &model = rig.model;
+  rig.busX = model.channel("bus_x");
+  rig.busY = model.channel("bus_y");
+  rig.busZ = model.channel("bus_z");
+  rig.busYaw = model.channel("bus_yaw");
+  rig.door = model.channel("door");
+  rig.window = model.channel("window");
+  rig.channels.assign(model.channelNames.size(), 0.0f);
+  setBusChannels(rig);
+  rig.posed = rig.channels;
+
+  for (size_t i = 0; i < model.size(); i++) {
+    graph.addNode(model.parent[i],
+                  model.localTransform((int)i, rig.channels.data()));
+    if (model.mesh[i] < 0)
+      continue;
+    const std::string &mesh = model.meshNames[model.mesh[i]];
+    if (mesh != "cube" && mesh != "sphere") {
+      std::cout << path << ": unknown mesh " << mesh << std::endl;
+      return false;
+    }
+    ScenePart part = {(int)i, mesh == "sphere", model.color[i],
+                      (model.flags[i] & PART_EMISSIVE) != 0};
+    parts.push_back(part);
   }
+  return true;
+}
 
-  // Door (Animating) - Adjusted
+// Step the door and window animations, and re-pose only the nodes that
+// depend on a channel changed since they were last set
+void animateBus(SceneGraph &graph, BusRig &rig) {
   if (doorOpening && doorOpen < 1.0f)
     doorOpen += deltaTime;
   if (!doorOpening && doorOpen > 0.0f)
     doorOpen -= deltaTime;
-  glm::mat4 dM = glm::translate(model, glm::vec3(1.01f, -0.2f, 1.5f));
-  dM =
-      glm::translate(dM, glm::vec3(0.0f, 0.0f, doorOpen * -0.8f)); // Slide open
-  dM = glm::scale(dM, glm::vec3(0.05f, 1.0f, 0.8f));
-  glUniform3fv(glGetUniformLocation(shaderProgram, "objectColor"), 1,
-               &doorColor[0]);
-  door.draw(shaderProgram, dM);
-
-  // Windows (Animating) - Adjusted
   if (windowOpening && windowOpen < 1.0f)
     windowOpen += deltaTime;
   if (!windowOpening && windowOpen > 0.0f)
     windowOpen -= deltaTime;
 
-  glUniform3fv(glGetUniformLocation(shaderProgram, "objectColor"), 1,
-               &windowColor[0]);
-  for (int i = 0; i < 3; i++) {
-    // Left windows
-    glm::mat4 wML =
-        glm::translate(model, glm::vec3(-1.01f, 0.3f, 1.5f - i * 1.5f));
-    wML = glm::translate(wML, glm::vec3(0.0f, windowOpen * -0.4f, 0.0f));
-    wML = glm::scale(wML, glm::vec3(0.05f, 0.6f, 1.0f));
-    windowPane.draw(shaderProgram, wML);
-    // Right windows
-    if (i > 0) { // Skip door area
-      glm::mat4 wMR =
-          glm::translate(model, glm::vec3(1.01f, 0.3f, 1.5f - i * 1.5f));
-      wMR = glm::translate(wMR, glm::vec3(0.0f, windowOpen * -0.4f, 0.0f));
-      wMR = glm::scale(wMR, glm::vec3(0.05f, 0.6f, 1.0f));
-      windowPane.draw(shaderProgram, wMR);
-    }
+  setBusChannels(rig);
+  uint32_t changed = 0;
+  for (size_t c = 0; c < rig.channels.size(); c++) {
+    if (rig.channels[c] != rig.posed[c])
+      changed |= 1u << c;
+  }
+  if (!changed)
+    return;
+  rig.posed = rig.channels;
+  const Model &model = rig.model;
+  for (size_t i = 0; i < model.size(); i++) {
+    if (model.localChannels[i] & changed)
+      graph.setLocal((int)i,
+                     model.localTransform((int)i, rig.channels.data()));
+  }
+}
+
+// Queue every part at its world transform into the cube and sphere batches
+void queueScene(const SceneGraph &graph, const std::vector<ScenePart> &parts,
+                Cube &cube, Sphere &sphere) {
+  cube.clear();
+  sphere.clear();
+  for (size_t i = 0; i < parts.size(); i++) {
+    const ScenePart &part = parts[i];
+    const glm::mat4 &model = graph.world[part.node];
+    if (part.sphere)
+      sphere.add(model, part.color, sphereLod(sphere, model), part.glows);
+    else
+      cube.add(model, part.color, part.glows);
   }
+  cube.upload();
+  sphere.upload();
+}
+
+// Locations of the per-pass uniforms, looked up once per program
+struct PassUniforms {
+  int firstViewport;
+  int viewportCount;
+};
+std::map<unsigned int, PassUniforms> passUniformCache;
+
+const PassUniforms &passUniforms(unsigned int shaderProgram) {
+  std::map<unsigned int, PassUniforms>::iterator it =
+      passUniformCache.find(shaderProgram);
+  if (it == passUniformCache.end()) {
+    PassUniforms u;
+    u.firstViewport = glGetUniformLocation(shaderProgram, "firstViewport");
+    u.viewportCount = glGetUniformLocation(shaderProgram, "viewportCount");
+    it = passUniformCache.insert(std::make_pair(shaderProgram, u)).first;
+  }
+  return it->second;
+}
+
+// Draw the batched parts into viewports firstViewport .. firstViewport +
+// viewportCount - 1, with shaderProgram bound. Returns the draw calls made.
+int drawScene(unsigned int shaderProgram, const Cube &cube,
+              const Sphere &sphere, int firstViewport, int viewportCount) {
+  const PassUniforms &u = passUniforms(shaderProgram);
+  glUniform1i(u.firstViewport, firstViewport);
+  glUniform1i(u.viewportCount, viewportCount);
+  return cube.draw(viewportCount) + sphere.draw(viewportCount);
 }
 
-int main() {
-  glfwInit();
+// source with "#define name value" added after its #version line
+std::string withDefine(const std::string &source, const char *name,
+                       int value) {
+  size_t version = source.find("#version");
+  size_t lineEnd = source.find('\n', version);
+  if (version == std::string::npos || lineEnd == std::string::npos)
+    return source;
+  return source.substr(0, lineEnd + 1) + "#define " + name + " " +
+         std::to_string(value) + "\n" + source.substr(lineEnd + 1);
+}
+
+// Programs for the one-pass-per-viewport path, one per lighting mask, with
+// the mask compiled in (LIGHTING_MASK in shaders.glsl) so switched-off terms
+// are folded away instead of branched on. Each is built the first time its
+// mask is drawn; one that fails to build falls back to the generic program.
+struct MaskedPrograms {
+  std::string vertexCode, fragmentCode;
+  unsigned int fallback;
+  ViewportBuffer *viewportBuffer;
+  std::map<int, unsigned int> programs;
+
+  unsigned int get(int mask) {
+    std::map<int, unsigned int>::iterator it = programs.find(mask);
+    if (it != programs.end())
+      return it->second;
+    unsigned int program = buildProgram(
+        vertexCode, withDefine(fragmentCode, "LIGHTING_MASK", mask), "");
+    if (program)
+      viewportBuffer->attach(program);
+    else
+      program = fallback;
+    programs[mask] = program;
+    return program;
+  }
+};
+
+// Light values that never change, set once when a program is first lit
+void setLightConstants(unsigned int shaderProgram) {
+  glUniform3fv(glGetUniformLocation(shaderProgram, "dirLight.direction"), 1,
+               &glm::vec3(-0.2f, -1.0f, -0.3f)[0]);
+  glUniform3fv(glGetUniformLocation(shaderProgram, "dirLight.ambient"), 1,
+               &glm::vec3(0.2f, 0.2f, 0.2f)[0]);
+  glUniform3fv(glGetUniformLocation(shaderProgram, "dirLight.diffuse"), 1,
+               &glm::vec3(0.4f, 0.4f, 0.4f)[0]);
+  glUniform3fv(glGetUniformLocation(shaderProgram, "dirLight.specular"), 1,
+               &glm::vec3(0.5f, 0.5f, 0.5f)[0]);
+
+  for (int i = 0; i < 4; i++) {
+    std::string number = std::to_string(i);
+    glUniform3fv(
+        glGetUniformLocation(shaderProgram,
+                             ("pointLights[" + number + "].ambient").c_str()),
+        1, &glm::vec3(0.05f, 0.05f, 0.05f)[0]);
+
+    // Standard High Intensity (Key 2 Toggles via uniform)
+    glUniform3fv(
+        glGetUniformLocation(shaderProgram,
+                             ("pointLights[" + number + "].diffuse").c_str()),
+        1, &glm::vec3(3.0f, 2.5f, 2.0f)[0]);
+    glUniform3fv(
+        glGetUniformLocation(
+            shaderProgram, ("pointLights[" + number + "].specular").c_str()),
+        1, &glm::vec3(1.0f, 1.0f, 1.0f)[0]);
+
+    glUniform1f(
+        glGetUniformLocation(
+            shaderProgram, ("pointLights[" + number + "].constant").c_str()),
+        1.0f);
+    glUniform1f(
+        glGetUniformLocation(shaderProgram,
+                             ("pointLights[" + number + "].linear").c_str()),
+        0.09f);
+    glUniform1f(
+        glGetUniformLocation(
+            shaderProgram, ("pointLights[" + number + "].quadratic").c_str()),
+        0.032f);
+  }
+
+  glUniform3fv(glGetUniformLocation(shaderProgram, "spotLight.ambient"), 1,
+               &glm::vec3(0.0f, 0.0f, 0.0f)[0]);
+  glUniform3fv(glGetUniformLocation(shaderProgram, "spotLight.diffuse"), 1,
+               &glm::vec3(1.0f, 1.0f, 0.8f)[0]); // Headlight Yellowish
+  glUniform3fv(glGetUniformLocation(shaderProgram, "spotLight.specular"), 1,
+               &glm::vec3(1.0f, 1.0f, 1.0f)[0]);
+  glUniform1f(glGetUniformLocation(shaderProgram, "spotLight.constant"),
+              1.0f);
+  glUniform1f(glGetUniformLocation(shaderProgram, "spotLight.linear"),
+              0.045f);
+  glUniform1f(glGetUniformLocation(shaderProgram, "spotLight.quadratic"),
+              0.0075f);
+  glUniform1f(glGetUniformLocation(shaderProgram, "spotLight.cutOff"),
+              glm::cos(glm::radians(25.5f)));
+}
+
+// Locations of the light uniforms that follow the bus, looked up (and the
+// constant ones set) once per program
+struct LightUniforms {
+  int pointPosition[4];
+  int spotPosition, spotDirection;
+};
+std::map<unsigned int, LightUniforms> lightUniformCache;
+
+const LightUniforms &lightUniforms(unsigned int shaderProgram) {
+  std::map<unsigned int, LightUniforms>::iterator it =
+      lightUniformCache.find(shaderProgram);
+  if (it == lightUniformCache.end()) {
+    setLightConstants(shaderProgram);
+    LightUniforms u;
+    for (int i = 0; i < 4; i++)
+      u.pointPosition[i] = glGetUniformLocation(
+          shaderProgram,
+          ("pointLights[" + std::to_string(i) + "].position").c_str());
+    u.spotPosition = glGetUniformLocation(shaderProgram, "spotLight.position");
+    u.spotDirection =
+        glGetUniformLocation(shaderProgram, "spotLight.direction");
+    it = lightUniformCache.insert(std::make_pair(shaderProgram, u)).first;
+  }
+  return it->second;
+}
+
+// Lights attached to the bus, for shaderProgram, which must be bound
+void setLights(unsigned int shaderProgram) {
+  const LightUniforms &u = lightUniforms(shaderProgram);
+
+  // Dynamic Point Lights (Attached to Bus Interior)
+  glm::mat4 busModel = glm::mat4(1.0f);
+  busModel = glm::translate(busModel, busPos);
+  busModel = glm::rotate(busModel, glm::radians(busYaw), glm::vec3(0, 1, 0));
+
+  for (int i = 0; i < 4; i++) {
+    // Calculate World Position of this bulb
+    glm::vec4 worldPos = busModel * glm::vec4(pointLightOffsets[i], 1.0f);
+    glUniform3fv(u.pointPosition[i], 1, &glm::vec3(worldPos)[0]);
+  }
+
+  // Dynamic Spotlight (Headlights)
+  float yawRad = glm::radians(busYaw);
+  glm::vec3 busForward(sin(yawRad), 0.0f, cos(yawRad));
+  glm::vec3 headlightPos = busPos + (busForward * 2.4f) +
+                           glm::vec3(0.0f, -0.2f, 0.0f); // Front bumper
+
+  glUniform3fv(u.spotPosition, 1, &headlightPos[0]);
+  glUniform3fv(u.spotDirection, 1, &busForward[0]);
+}
+
+int main(int argc, char **argv) {
+  HeadlessOptions headless = HeadlessOptions::parse(argc, argv);
+  if (!initGlfw(headless.enabled))
+    return -1;
   glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
   glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
   glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
@@ -487,8 +751,8 @@ int main() {
   glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 #endif
 
-  GLFWwindow *window = glfwCreateWindow(
-      1000, 800, "Assignment 03 - Precision Lighting", NULL, NULL);
+  GLFWwindow *window = createWindow(
+      1000, 800, "Assignment 03 - Precision Lighting", headless.enabled);
   if (!window) {
     glfwTerminate();
     return -1;
@@ -497,58 +761,39 @@ int main() {
   glewInit();
   glEnable(GL_DEPTH_TEST);
 
-  std::string shaderContent = readShaderCode("shaders.glsl");
-  size_t splitPos = shaderContent.find("// <!-- split -->");
-  std::string vertexCode, fragmentCode;
-  if (splitPos != std::string::npos) {
-    vertexCode = shaderContent.substr(0, splitPos);
-    fragmentCode = shaderContent.substr(splitPos + 17);
-  } else {
+  std::vector<std::string> shaderSections =
+      splitShaderSource(readShaderCode("shaders.glsl"));
+  if (shaderSections.size() < 2) {
     std::cerr << "Could not split shader file!" << std::endl;
     return -1;
   }
-  const char *vShaderCode = vertexCode.c_str();
-  const char *fShaderCode = fragmentCode.c_str();
-
-  unsigned int vertexShader = glCreateShader(GL_VERTEX_SHADER);
-  glShaderSource(vertexShader, 1, &vShaderCode, NULL);
-  glCompileShader(vertexShader);
-  int success;
-  char infoLog[512];
-  glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
-  if (!success) {
-    glGetShaderInfoLog(vertexShader, 512, NULL, infoLog);
-    std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n"
-              << infoLog << std::endl;
-  }
-  unsigned int fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-  glShaderSource(fragmentShader, 1, &fShaderCode, NULL);
-  glCompileShader(fragmentShader);
-  glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
-  if (!success) {
-    glGetShaderInfoLog(fragmentShader, 512, NULL, infoLog);
-    std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n"
-              << infoLog << std::endl;
-  }
-  unsigned int shaderProgram = glCreateProgram();
-  glAttachShader(shaderProgram, vertexShader);
-  glAttachShader(shaderProgram, fragmentShader);
-  glLinkProgram(shaderProgram);
-  glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
-  if (!success) {
-    glGetProgramInfoLog(shaderProgram, 512, NULL, infoLog);
-    std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n"
-              << infoLog << std::endl;
-  }
-  glDeleteShader(vertexShader);
-  glDeleteShader(fragmentShader);
+  // One pass per viewport works anywhere; the single-pass quad view routes
+  // triangles to viewports from a geometry shader via gl_ViewportIndex
+  unsigned int viewportProgram =
+      buildProgram(shaderSections[0], shaderSections[1], "");
+  unsigned int quadProgram = 0;
+  if (shaderSections.size() > 2 && GLEW_ARB_viewport_array)
+    quadProgram =
+        buildProgram(shaderSections[0], shaderSections[1], shaderSections[2]);
+  if (!quadProgram)
+    std::cout << "No single-pass quad view, drawing one pass per viewport"
+              << std::endl;
 
-  Cube busBody(glm::vec3(0.8f, 0.8f, 0.8f));
-  Sphere wheel(glm::vec3(0.1f, 0.1f, 0.1f));
-  Cube windowPane(glm::vec3(0.0f, 0.5f, 0.8f));
-  Cube door(glm::vec3(0.5f, 0.3f, 0.1f));
-  Cube fan(glm::vec3(1.0f, 1.0f, 0.0f));
-  Cube windshield(glm::vec3(0.0f, 0.7f, 0.9f));
+  // Cameras and lighting masks of all four viewports, one upload a frame
+  ViewportBuffer viewportBuffer;
+  viewportBuffer.attach(viewportProgram);
+  if (quadProgram)
+    viewportBuffer.attach(quadProgram);
+  MaskedPrograms maskedPrograms;
+  maskedPrograms.vertexCode = shaderSections[0];
+  maskedPrograms.fragmentCode = shaderSections[1];
+  maskedPrograms.fallback = viewportProgram;
+  maskedPrograms.viewportBuffer = &viewportBuffer;
+
+  // Every box of the scene is a scaled cube and every round part a sphere,
+  // each drawn as one batch
+  Cube cube;
+  Sphere sphere;
 
   // Initialize Viewports
   viewports[0].mode = CAM_ISO;    // TL: ISO (Combined Lighting)
@@ -558,199 +803,139 @@ int main() {
 
   std::cout << "Controls:\n1-3: Toggle Lights\n4: Toggle Emissive\n5-7: Toggle "
                "Components\nArrows: Move Bus\nQ/Shift+W/E/R: Cycle Cameras per "
-               "Viewport"
+               "Viewport\nV: Toggle Single-Pass Quad View"
             << std::endl;
 
+  // Headless frames go to an FBO, as there may be no default framebuffer
+  std::unique_ptr<OffscreenTarget> offscreen;
+  if (headless.enabled)
+    offscreen.reset(new OffscreenTarget(1000, 800));
+  int frameIndex = 0;
+
+  // Per-section CPU/GPU times, shown in the title bar once a second
+  Profiler profiler(!headless.traceJson.empty());
+  float statsTimer = 0.0f;
+  const char *viewportSections[4] = {"viewport combined", "viewport ambient",
+                                     "viewport diffuse", "viewport inside"};
+  int frameDraws = 0;
+  int frameTransforms = 0;
+
+  // Bus hierarchy, built once and re-posed as the bus moves
+  SceneGraph sceneGraph;
+  std::vector<ScenePart> sceneParts;
+  BusRig busRig;
+  if (!buildScene(SCENE_MODEL_PATH, sceneGraph, sceneParts, busRig)) {
+    glfwTerminate();
+    return -1;
+  }
+
   while (!glfwWindowShouldClose(window)) {
+    profiler.beginFrame();
     float currentFrame = glfwGetTime();
     deltaTime = currentFrame - lastFrame;
     lastFrame = currentFrame;
+    profiler.begin("input", false);
     processInput(window);
+    profiler.end();
     glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+    if (offscreen)
+      offscreen->bind();
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glUseProgram(shaderProgram);
-
-    // Common Lighting Setup (Positions/Colors)
-    glUniform3fv(glGetUniformLocation(shaderProgram, "dirLight.direction"), 1,
-                 &glm::vec3(-0.2f, -1.0f, -0.3f)[0]);
-    glUniform3fv(glGetUniformLocation(shaderProgram, "dirLight.ambient"), 1,
-                 &glm::vec3(0.2f, 0.2f, 0.2f)[0]);
-    glUniform3fv(glGetUniformLocation(shaderProgram, "dirLight.diffuse"), 1,
-                 &glm::vec3(0.4f, 0.4f, 0.4f)[0]);
-    glUniform3fv(glGetUniformLocation(shaderProgram, "dirLight.specular"), 1,
-                 &glm::vec3(0.5f, 0.5f, 0.5f)[0]);
-
-    // Dynamic Point Lights (Attached to Bus Interior)
-    glm::mat4 busModel = glm::mat4(1.0f);
-    busModel = glm::translate(busModel, busPos);
-    busModel = glm::rotate(busModel, glm::radians(busYaw), glm::vec3(0, 1, 0));
-
-    for (int i = 0; i < 4; i++) {
-      // Calculate World Position of this bulb
-      glm::vec4 worldPos = busModel * glm::vec4(pointLightOffsets[i], 1.0f);
-
-      std::string number = std::to_string(i);
-      glUniform3fv(
-          glGetUniformLocation(
-              shaderProgram, ("pointLights[" + number + "].position").c_str()),
-          1, &glm::vec3(worldPos)[0]);
-      glUniform3fv(
-          glGetUniformLocation(shaderProgram,
-                               ("pointLights[" + number + "].ambient").c_str()),
-          1, &glm::vec3(0.05f, 0.05f, 0.05f)[0]);
-
-      // Standard High Intensity (Key 2 Toggles via uniform)
-      glUniform3fv(
-          glGetUniformLocation(shaderProgram,
-                               ("pointLights[" + number + "].diffuse").c_str()),
-          1, &glm::vec3(3.0f, 2.5f, 2.0f)[0]);
-      glUniform3fv(
-          glGetUniformLocation(
-              shaderProgram, ("pointLights[" + number + "].specular").c_str()),
-          1, &glm::vec3(1.0f, 1.0f, 1.0f)[0]);
-
-      glUniform1f(
-          glGetUniformLocation(
-              shaderProgram, ("pointLights[" + number + "].constant").c_str()),
-          1.0f);
-      glUniform1f(
-          glGetUniformLocation(shaderProgram,
-                               ("pointLights[" + number + "].linear").c_str()),
-          0.09f);
-      glUniform1f(
-          glGetUniformLocation(
-              shaderProgram, ("pointLights[" + number + "].quadratic").c_str()),
-          0.032f);
-    }
-
-    // Dynamic Spotlight (Headlights)
-    float yawRad = glm::radians(busYaw);
-    glm::vec3 busForward(sin(yawRad), 0.0f, cos(yawRad));
-    glm::vec3 headlightPos = busPos + (busForward * 2.4f) +
-                             glm::vec3(0.0f, -0.2f, 0.0f); // Front bumper
-
-    glUniform3fv(glGetUniformLocation(shaderProgram, "spotLight.position"), 1,
-                 &headlightPos[0]);
-    glUniform3fv(glGetUniformLocation(shaderProgram, "spotLight.direction"), 1,
-                 &busForward[0]);
-    glUniform3fv(glGetUniformLocation(shaderProgram, "spotLight.ambient"), 1,
-                 &glm::vec3(0.0f, 0.0f, 0.0f)[0]);
-    glUniform3fv(glGetUniformLocation(shaderProgram, "spotLight.diffuse"), 1,
-                 &glm::vec3(1.0f, 1.0f, 0.8f)[0]); // Headlight Yellowish
-    glUniform3fv(glGetUniformLocation(shaderProgram, "spotLight.specular"), 1,
-                 &glm::vec3(1.0f, 1.0f, 1.0f)[0]);
-    glUniform1f(glGetUniformLocation(shaderProgram, "spotLight.constant"),
-                1.0f);
-    glUniform1f(glGetUniformLocation(shaderProgram, "spotLight.linear"),
-                0.045f);
-    glUniform1f(glGetUniformLocation(shaderProgram, "spotLight.quadratic"),
-                0.0075f);
-    glUniform1f(glGetUniformLocation(shaderProgram, "spotLight.cutOff"),
-                glm::cos(glm::radians(25.5f)));
+    bool quadPass = singlePass && quadProgram != 0;
 
     int width, height;
     glfwGetFramebufferSize(window, &width, &height);
+    if (offscreen) {
+      width = offscreen->width;
+      height = offscreen->height;
+    }
     int halfW = width / 2;
     int halfH = height / 2;
 
-    for (int i = 0; i < 4; i++) {
-      // Viewport & Scissor Setup
-      int x = 0, y = 0;
-      if (i == 0) {
-        x = 0;
-        y = halfH;
-      } // TL
-      else if (i == 1) {
-        x = halfW;
-        y = halfH;
-      } // TR
-      else if (i == 2) {
-        x = 0;
-        y = 0;
-      } // BL
-      else if (i == 3) {
-        x = halfW;
-        y = 0;
-      } // BR
-
-      glViewport(x, y, halfW, halfH);
-
-      // Lighting Configuration per Viewport (Strict Compliance)
-      bool locDir = dirLightOn;
-      bool locPoint = pointLightOn;
-      bool locSpot = spotLightOn;
-      bool locAmb = ambientOn;
-      bool locDiff = diffuseOn;
-      bool locSpec = specularOn;
-
-      // Emissive (Bulb Glow) linked to Point Light (Interior Light)
-      // "Interior light and emissive bulbs should be the same thing"
-      bool locEmit = pointLightOn;
-
-      // TL (Combined): Use global state (already set)
-
-      // TR (Ambient Only): Force Ambient ON, others OFF
-      if (i == 1) {
-        locDir = true;
-        locPoint = false;
-        locSpot = false;
-        locAmb = true;
-        locDiff = false;
-        locSpec = false;
-        locEmit = false; // Linked to Point Light
-      }
-      // BL (Diffuse Only): Force Diffuse ON, others OFF
-      if (i == 2) {
-        locDir = true;
-        locPoint = false;
-        locSpot = false;
-        locAmb = false;
-        locDiff = true;
-        locSpec = false;
-        locEmit = false; // Linked to Point Light
-      }
-      // BR (Inside View): Directional Lighting + User Controls
-      if (i == 3) {
-        locDir = true;
-        locPoint = pointLightOn; // Allow toggling
-        locSpot = false;
-        locAmb = ambientOn;
-        locDiff = true;
-        locSpec = true;
-        locEmit = pointLightOn; // Linked to Point Light
-      }
+    int viewportX[4] = {0, halfW, 0, halfW}; // TL, TR, BL, BR
+    int viewportY[4] = {halfH, halfH, 0, 0};
 
-      glUniform1i(glGetUniformLocation(shaderProgram, "dirLightOn"), locDir);
-      glUniform1i(glGetUniformLocation(shaderProgram, "pointLightOn"),
-                  locPoint);
-      glUniform1i(glGetUniformLocation(shaderProgram, "spotLightOn"), locSpot);
-      glUniform1i(glGetUniformLocation(shaderProgram, "ambientOn"), locAmb);
-      glUniform1i(glGetUniformLocation(shaderProgram, "diffuseOn"), locDiff);
-      glUniform1i(glGetUniformLocation(shaderProgram, "specularOn"), locSpec);
-      glUniform1i(glGetUniformLocation(shaderProgram, "emissiveOn"), locEmit);
-
-      // Camera View
-      glm::mat4 view = GetViewMatrix(viewports[i].mode);
-      glm::mat4 projection = glm::perspective(
+    // Camera View and lighting toggles of every viewport, uploaded once for
+    // either path
+    for (int i = 0; i < VIEWPORT_COUNT; i++) {
+      ViewportStd140 &vp = viewportBuffer.viewports[i];
+      vp.view = GetViewMatrix(viewports[i].mode);
+      vp.projection = glm::perspective(
           glm::radians(45.0f), (float)halfW / (float)halfH, 0.1f, 100.0f);
-
-      glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "projection"), 1,
-                         GL_FALSE, &projection[0][0]);
-      glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "view"), 1,
-                         GL_FALSE, &view[0][0]);
-
       // Extract view pos for specular calculation
-      glm::vec3 viewPos = glm::vec3(glm::inverse(view)[3]);
-      glUniform3fv(glGetUniformLocation(shaderProgram, "viewPos"), 1,
-                   &viewPos[0]);
+      vp.viewPos = glm::vec3(glm::inverse(vp.view)[3]);
+      vp.lightingMask = viewportLighting(i);
+      viewportViews[i] = vp.view;
+      viewportProjScales[i] = vp.projection[1][1] * halfH * 0.5f;
+    }
+    viewportBuffer.upload();
+
+    // Program of each pass: the geometry-shader one for the whole quad view,
+    // else the one built for each viewport's lighting mask
+    unsigned int passPrograms[VIEWPORT_COUNT];
+    for (int i = 0; i < VIEWPORT_COUNT; i++) {
+      int mask = viewportBuffer.viewports[i].lightingMask;
+      passPrograms[i] = quadPass ? quadProgram : maskedPrograms.get(mask);
+    }
+    profiler.begin("lighting");
+    for (int i = 0; i < VIEWPORT_COUNT; i++) {
+      if (std::find(passPrograms, passPrograms + i, passPrograms[i]) !=
+          passPrograms + i)
+        continue;
+      glUseProgram(passPrograms[i]);
+      setLights(passPrograms[i]);
+    }
+    profiler.end();
+
+    // The bus is posed and queued once a frame, however many passes draw it
+    profiler.begin("build scene", false);
+    animateBus(sceneGraph, busRig);
+    frameTransforms = sceneGraph.update();
+    queueScene(sceneGraph, sceneParts, cube, sphere);
+    profiler.end();
+
+    if (quadPass) {
+      Profiler::Scope scope(profiler, "quad view");
+      glUseProgram(quadProgram);
+      for (int i = 0; i < 4; i++)
+        glViewportIndexedf(i, (float)viewportX[i], (float)viewportY[i],
+                           (float)halfW, (float)halfH);
+      frameDraws = drawScene(quadProgram, cube, sphere, 0, 4);
+    } else {
+      frameDraws = 0;
+      for (int i = 0; i < 4; i++) {
+        Profiler::Scope scope(profiler, viewportSections[i]);
+        glUseProgram(passPrograms[i]);
+        glViewport(viewportX[i], viewportY[i], halfW, halfH);
+        frameDraws += drawScene(passPrograms[i], cube, sphere, i, 1);
+      }
+    }
 
-      renderScene(shaderProgram, busBody, wheel, windowPane, door, windshield,
-                  locEmit);
+    statsTimer += deltaTime;
+    if (statsTimer >= 1.0f) {
+      std::string title = "Assignment 03 - Precision Lighting | draws " +
+                          std::to_string(frameDraws) + " | transforms " +
+                          std::to_string(frameTransforms) + "/" +
+                          std::to_string(sceneGraph.size()) +
+                          " | cpu/gpu ms: " + profiler.takeSummary();
+      glfwSetWindowTitle(window, title.c_str());
+      statsTimer = 0.0f;
     }
 
+    if (offscreen && headless.shouldCapture(frameIndex))
+      offscreen->saveFrame(headless.captureDir, frameIndex);
+    frameIndex++;
+    if (headless.frames > 0 && frameIndex >= headless.frames)
+      glfwSetWindowShouldClose(window, true);
+
+    profiler.begin("swap", false);
     glfwSwapBuffers(window);
+    profiler.end();
     glfwPollEvents();
   }
+  if (!headless.traceJson.empty())
+    profiler.writeChromeTrace(headless.traceJson);
+  offscreen.reset();
   glfwTerminate();
   return 0;
 }
@@ -0,0 +1,203 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <GL/glew.h>
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+// Named CPU and GPU timings for the sections of each frame. CPU time is
+// wall clock around the section. GPU time comes from a GL_TIME_ELAPSED
+// query, read back a few frames later when the result is available, so
+// the pipeline never stalls. Elapsed-time queries cannot nest, so GPU
+// timing is taken only for sections that don't overlap another timed one.
+//
+// Per-section means feed the window-title overlay (takeSummary). With
+// tracing on, every section is also kept for a Chrome trace
+// (chrome://tracing, Perfetto). CPU sections go on one track. GPU sections
+// go on a second track, placed at their CPU start since elapsed queries
+// carry no timestamp.
+class Profiler {
+public:
+  // RAII section: Profiler::Scope s(profiler, "lanterns");
+  class Scope {
+  public:
+    Scope(Profiler &profiler, const char *name, bool gpu = true)
+        : profiler(profiler) {
+      profiler.begin(name, gpu);
+    }
+    ~Scope() { profiler.end(); }
+
+  private:
+    Profiler &profiler;
+  };
+
+  Profiler(bool trace = false)
+      : trace(trace), gpuTiming(GLEW_ARB_timer_query),
+        origin(std::chrono::steady_clock::now()) {}
+
+  Profiler(const Profiler &) = delete;
+  Profiler &operator=(const Profiler &) = delete;
+
+  // Start of a frame: pick up GPU results that have arrived
+  void beginFrame() {
+    for (size_t i = 0; i < pending.size();) {
+      GLint available = 0;
+      glGetQueryObjectiv(pending[i].query, GL_QUERY_RESULT_AVAILABLE,
+                         &available);
+      if (!available) {
+        i++;
+        continue;
+      }
+      GLuint64 ns = 0;
+      glGetQueryObjectui64v(pending[i].query, GL_QUERY_RESULT, &ns);
+      double us = ns / 1000.0;
+      Totals &t = totals[pending[i].name];
+      t.gpuUs += us;
+      t.gpuCount++;
+      if (pending[i].event >= 0)
+        events[pending[i].event].gpuUs = us;
+      freeQueries.push_back(pending[i].query);
+      pending[i] = pending.back();
+      pending.pop_back();
+    }
+  }
+
+  void begin(const char *name, bool gpu = true) {
+    Open open;
+    open.name = name;
+    open.startUs = nowUs();
+    open.query = 0;
+    if (gpu && gpuTiming && !gpuActive) {
+      open.query = takeQuery();
+      glBeginQuery(GL_TIME_ELAPSED, open.query);
+      gpuActive = true;
+    }
+    stack.push_back(open);
+  }
+
+  void end() {
+    Open open = stack.back();
+    stack.pop_back();
+    double cpuUs = nowUs() - open.startUs;
+    Totals &t = totals[open.name];
+    t.cpuUs += cpuUs;
+    t.cpuCount++;
+
+    int event = -1;
+    if (trace) {
+      event = (int)events.size();
+      events.push_back({open.name, open.startUs, cpuUs, -1.0});
+    }
+    if (open.query) {
+      glEndQuery(GL_TIME_ELAPSED);
+      gpuActive = false;
+      pending.push_back({open.name, open.query, event});
+    }
+  }
+
+  // "name cpu/gpu" mean milliseconds of every section since the last call,
+  // sorted by name
+  std::string takeSummary() {
+    std::string out;
+    char buf[96];
+    for (const auto &entry : totals) {
+      const Totals &t = entry.second;
+      if (t.cpuCount == 0)
+        continue;
+      if (t.gpuCount > 0)
+        std::snprintf(buf, sizeof(buf), "%s %.2f/%.2f", entry.first.c_str(),
+                      t.cpuUs / t.cpuCount / 1000.0,
+                      t.gpuUs / t.gpuCount / 1000.0);
+      else
+        std::snprintf(buf, sizeof(buf), "%s %.2f", entry.first.c_str(),
+                      t.cpuUs / t.cpuCount / 1000.0);
+      out += out.empty() ? buf : std::string(", ") + buf;
+    }
+    totals.clear();
+    return out;
+  }
+
+  // Chrome trace event JSON of every section recorded since startup
+  bool writeChromeTrace(const std::string &path) const {
+    FILE *file = std::fopen(path.c_str(), "w");
+    if (!file) {
+      std::cout << "Could not write trace to " << path << std::endl;
+      return false;
+    }
+    std::fprintf(file, "{\"traceEvents\":[\n");
+    std::fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                       "\"tid\":1,\"args\":{\"name\":\"CPU\"}},\n");
+    std::fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                       "\"tid\":2,\"args\":{\"name\":\"GPU\"}}");
+    for (const Event &e : events) {
+      std::fprintf(file,
+                   ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,"
+                   "\"ts\":%.3f,\"dur\":%.3f}",
+                   e.name, e.startUs, e.cpuUs);
+      if (e.gpuUs >= 0.0)
+        std::fprintf(file,
+                     ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":2,"
+                     "\"ts\":%.3f,\"dur\":%.3f}",
+                     e.name, e.startUs, e.gpuUs);
+    }
+    std::fprintf(file, "\n]}\n");
+    bool ok = std::fclose(file) == 0;
+    std::cout << "Trace of " << events.size() << " sections written to "
+              << path << std::endl;
+    return ok;
+  }
+
+private:
+  struct Open {
+    const char *name;
+    double startUs;
+    GLuint query;
+  };
+  struct Pending {
+    const char *name;
+    GLuint query;
+    int event; // index into events, or -1
+  };
+  struct Event {
+    const char *name;
+    double startUs, cpuUs, gpuUs; // gpuUs < 0 until known
+  };
+  struct Totals {
+    double cpuUs = 0.0, gpuUs = 0.0;
+    int cpuCount = 0, gpuCount = 0;
+  };
+
+  bool trace;
+  bool gpuTiming;
+  bool gpuActive = false;
+  std::chrono::steady_clock::time_point origin;
+  std::vector<Open> stack;
+  std::vector<Pending> pending;
+  std::vector<GLuint> freeQueries;
+  std::vector<Event> events;
+  std::map<std::string, Totals> totals;
+
+  double nowUs() const {
+    return std::chrono::duration<double, std::micro>(
+               std::chrono::steady_clock::now() - origin)
+        .count();
+  }
+
+  GLuint takeQuery() {
+    if (freeQueries.empty()) {
+      GLuint query;
+      glGenQueries(1, &query);
+      return query;
+    }
+    GLuint query = freeQueries.back();
+    freeQueries.pop_back();
+    return query;
+  }
+};
+
+#endif
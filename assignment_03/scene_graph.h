@@ -0,0 +1,56 @@
+#ifndef SCENE_GRAPH_H
+#define SCENE_GRAPH_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <vector>
+
+// Transform hierarchy kept as parallel arrays, one entry per node, in
+// topological order: a node is always added after its parent. World matrices
+// are then brought up to date in a single forward sweep, where a node is
+// recomputed only if its own local transform changed or its parent's world
+// matrix was recomputed earlier in the same sweep.
+class SceneGraph {
+public:
+  std::vector<int> parent; // -1 for a root
+  std::vector<glm::mat4> local;
+  std::vector<glm::mat4> world;
+  std::vector<unsigned char> dirty;
+
+  // parentNode must already exist (or be -1), which keeps the order
+  // topological. Returns the new node.
+  int addNode(int parentNode, const glm::mat4 &localTransform) {
+    int node = (int)parent.size();
+    parent.push_back(parentNode);
+    local.push_back(localTransform);
+    world.push_back(localTransform);
+    dirty.push_back(1);
+    return node;
+  }
+
+  void setLocal(int node, const glm::mat4 &localTransform) {
+    local[node] = localTransform;
+    dirty[node] = 1;
+  }
+
+  size_t size() const { return parent.size(); }
+
+  // Recompute the world matrices that are out of date. Returns how many were.
+  int update() {
+    int updated = 0;
+    for (size_t i = 0; i < parent.size(); i++) {
+      int p = parent[i];
+      if (p >= 0 && dirty[p])
+        dirty[i] = 1;
+      if (!dirty[i])
+        continue;
+      world[i] = p >= 0 ? world[p] * local[i] : local[i];
+      updated++;
+    }
+    std::fill(dirty.begin(), dirty.end(), 0);
+    return updated;
+  }
+};
+
+#endif
@@ -2,18 +2,45 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
+// Per part, stepped every viewportCount instances (see InstanceBatch)
+layout (location = 2) in mat4 aModel;
+layout (location = 6) in vec3 aColor;
+layout (location = 7) in float aGlows;
 
-out vec3 FragPos;
-out vec3 Normal;
+// Read by the fragment shader, and passed through by the geometry shader in
+// the single-pass quad view
+out VertexData {
+    vec3 FragPos;
+    vec3 Normal;
+    flat vec3 ObjectColor;
+    flat float Glows;
+    flat int Viewport;
+} vs_out;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// Camera and lighting of each quad viewport (see ViewportBuffer). Each part
+// is drawn as viewportCount consecutive instances, the ith seen from
+// viewport firstViewport + i: four per part in the single-pass path, one per
+// viewport pass otherwise.
+struct Viewport {
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+    int lightingMask;
+};
+layout (std140) uniform Viewports {
+    Viewport viewports[4];
+};
+uniform int firstViewport;
+uniform int viewportCount;
 
 void main() {
-    FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal = mat3(transpose(inverse(model))) * aNormal;
-    gl_Position = projection * view * vec4(FragPos, 1.0);
+    int viewport = firstViewport + gl_InstanceID % viewportCount;
+    vs_out.FragPos = vec3(aModel * vec4(aPos, 1.0));
+    vs_out.Normal = mat3(transpose(inverse(aModel))) * aNormal;
+    vs_out.ObjectColor = aColor;
+    vs_out.Glows = aGlows;
+    vs_out.Viewport = viewport;
+    gl_Position = viewports[viewport].projection * viewports[viewport].view * vec4(vs_out.FragPos, 1.0);
 }
 
 // <!-- split -->
@@ -53,23 +80,48 @@ struct SpotLight {
 
 #define NR_POINT_LIGHTS 4
 
-in vec3 FragPos;
-in vec3 Normal;
+in VertexData {
+    vec3 FragPos;
+    vec3 Normal;
+    flat vec3 ObjectColor;
+    flat float Glows;
+    flat int Viewport;
+} fs_in;
 
-uniform vec3 viewPos;
+struct Viewport {
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+    int lightingMask;
+};
+layout (std140) uniform Viewports {
+    Viewport viewports[4];
+};
 uniform DirLight dirLight;
 uniform PointLight pointLights[NR_POINT_LIGHTS];
 uniform SpotLight spotLight;
-uniform vec3 objectColor; // Material color
 
-// Toggles
-uniform bool dirLightOn;
-uniform bool pointLightOn;
-uniform bool spotLightOn;
-uniform bool ambientOn;
-uniform bool diffuseOn;
-uniform bool specularOn;
-uniform bool emissiveOn; // For emissive light (Assignment requirement 2)
+// Toggles of each viewport, packed (see LightingBit in main.cpp)
+#define LIGHT_DIR 1
+#define LIGHT_POINT 2
+#define LIGHT_SPOT 4
+#define LIGHT_AMBIENT 8
+#define LIGHT_DIFFUSE 16
+#define LIGHT_SPECULAR 32
+#define LIGHT_EMISSIVE 64
+
+// Unpacked from the mask of the viewport being shaded. Programs built for
+// one viewport pass get LIGHTING_MASK defined, which makes every toggle a
+// constant and compiles the switched-off terms out.
+#ifdef LIGHTING_MASK
+const bool ambientOn = (LIGHTING_MASK & LIGHT_AMBIENT) != 0;
+const bool diffuseOn = (LIGHTING_MASK & LIGHT_DIFFUSE) != 0;
+const bool specularOn = (LIGHTING_MASK & LIGHT_SPECULAR) != 0;
+#else
+bool ambientOn;
+bool diffuseOn;
+bool specularOn;
+#endif
 
 // Function prototypes
 vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir);
@@ -77,31 +129,42 @@ vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
 vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
 
 void main() {
-    vec3 norm = normalize(Normal);
-    vec3 viewDir = normalize(viewPos - FragPos);
+#ifdef LIGHTING_MASK
+    const int mask = LIGHTING_MASK;
+#else
+    int mask = viewports[fs_in.Viewport].lightingMask;
+    ambientOn = (mask & LIGHT_AMBIENT) != 0;
+    diffuseOn = (mask & LIGHT_DIFFUSE) != 0;
+    specularOn = (mask & LIGHT_SPECULAR) != 0;
+#endif
+
+    vec3 norm = normalize(fs_in.Normal);
+    vec3 viewDir = normalize(viewports[fs_in.Viewport].viewPos - fs_in.FragPos);
 
     vec3 result = vec3(0.0);
 
     // Phase 1: Directional Light
-    if(dirLightOn)
+    if((mask & LIGHT_DIR) != 0)
         result += CalcDirLight(dirLight, norm, viewDir);
 
     // Phase 2: Point Lights
-    if(pointLightOn) {
+    if((mask & LIGHT_POINT) != 0) {
         for(int i = 0; i < NR_POINT_LIGHTS; i++)
-            result += CalcPointLight(pointLights[i], norm, FragPos, viewDir);
+            result += CalcPointLight(pointLights[i], norm, fs_in.FragPos, viewDir);
     }
 
     // Phase 3: Spot Light
-    if(spotLightOn)
-        result += CalcSpotLight(spotLight, norm, FragPos, viewDir);
+    if((mask & LIGHT_SPOT) != 0)
+        result += CalcSpotLight(spotLight, norm, fs_in.FragPos, viewDir);
         
     // Final Color = (Lighting * Material) + Emissive
+    vec3 objectColor = fs_in.ObjectColor; // Material color
     vec3 finalColor = result * objectColor;
 
     // Emissive component (Assignment requirement: "emissive light")
     // Adds a glow effect independent of external lighting
-    if(emissiveOn) {
+    // (only parts that glow, while their viewport has emissive on)
+    if(fs_in.Glows > 0.5 && (mask & LIGHT_EMISSIVE) != 0) {
         finalColor += objectColor * 0.4; 
     }
 
@@ -184,3 +247,42 @@ vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir) {
         return vec3(0.0);
     }
 }
+
+// <!-- split -->
+
+// Geometry Shader (single-pass quad view only)
+// Sends each triangle to the viewport its instance was drawn for
+#version 330 core
+#extension GL_ARB_viewport_array : require
+layout (triangles) in;
+layout (triangle_strip, max_vertices = 3) out;
+
+in VertexData {
+    vec3 FragPos;
+    vec3 Normal;
+    flat vec3 ObjectColor;
+    flat float Glows;
+    flat int Viewport;
+} gs_in[];
+
+out VertexData {
+    vec3 FragPos;
+    vec3 Normal;
+    flat vec3 ObjectColor;
+    flat float Glows;
+    flat int Viewport;
+} gs_out;
+
+void main() {
+    for (int i = 0; i < 3; i++) {
+        gs_out.FragPos = gs_in[i].FragPos;
+        gs_out.Normal = gs_in[i].Normal;
+        gs_out.ObjectColor = gs_in[i].ObjectColor;
+        gs_out.Glows = gs_in[i].Glows;
+        gs_out.Viewport = gs_in[i].Viewport;
+        gl_ViewportIndex = gs_in[i].Viewport;
+        gl_Position = gl_in[i].gl_Position;
+        EmitVertex();
+    }
+    EndPrimitive();
+}
@@ -0,0 +1,59 @@
+#ifndef VIEWPORT_BUFFER_H
+#define VIEWPORT_BUFFER_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+// Must match the Viewports block in shaders.glsl
+const int VIEWPORT_COUNT = 4;
+const unsigned int VIEWPORT_BLOCK_BINDING = 0;
+
+// Camera and lighting of one quad viewport in std140 layout. The packed
+// lighting mask (LightingBit in main.cpp) rides in the fourth component of
+// the eye position.
+struct ViewportStd140 {
+  glm::mat4 view;
+  glm::mat4 projection;
+  glm::vec3 viewPos;
+  int lightingMask;
+};
+static_assert(sizeof(ViewportStd140) == 144, "std140 Viewport is 144 bytes");
+
+// CPU-side copy of the Viewports uniform buffer: all four viewports are
+// filled in, then sent in a single glBufferSubData per frame, whichever
+// path or program draws them.
+class ViewportBuffer {
+public:
+  unsigned int UBO;
+  ViewportStd140 viewports[VIEWPORT_COUNT];
+
+  ViewportBuffer() {
+    for (int i = 0; i < VIEWPORT_COUNT; i++)
+      viewports[i] = ViewportStd140();
+    glGenBuffers(1, &UBO);
+    glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(viewports), viewports,
+                 GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, VIEWPORT_BLOCK_BINDING, UBO);
+  }
+
+  ViewportBuffer(const ViewportBuffer &) = delete;
+  ViewportBuffer &operator=(const ViewportBuffer &) = delete;
+
+  // point the program's Viewports block at our binding point (GLSL 330 has
+  // no layout(binding = N), so this is done once per program after link)
+  void attach(unsigned int program) {
+    unsigned int index = glGetUniformBlockIndex(program, "Viewports");
+    if (index != GL_INVALID_INDEX)
+      glUniformBlockBinding(program, index, VIEWPORT_BLOCK_BINDING);
+  }
+
+  void upload() {
+    glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(viewports), viewports);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  }
+};
+
+#endif
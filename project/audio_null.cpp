@@ -0,0 +1,6 @@
+// Silent stand-in for audio.mm on platforms without AVFoundation
+#include "audio.h"
+
+void startBackgroundMusic(const char *filePath) {}
+
+void stopBackgroundMusic() {}
@@ -0,0 +1,132 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include "camera.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// One pose of a scripted camera path, reached at `time` seconds
+struct CameraKey {
+  float time;
+  glm::vec3 position;
+  float yaw, pitch;
+};
+
+// Camera fly-through as keyframes in time order, interpolated linearly.
+// Driven by simulated time, so every run sees the same poses per frame.
+class CameraPath {
+public:
+  std::vector<CameraKey> keys;
+
+  void add(float time, glm::vec3 position, float yaw, float pitch) {
+    keys.push_back({time, position, yaw, pitch});
+  }
+
+  float duration() const { return keys.empty() ? 0.0f : keys.back().time; }
+
+  void apply(Camera &camera, float time) const {
+    if (keys.empty())
+      return;
+    size_t next = 0;
+    while (next < keys.size() && keys[next].time < time)
+      next++;
+    const CameraKey &b = keys[std::min(next, keys.size() - 1)];
+    const CameraKey &a = next == 0 ? b : keys[next - 1];
+    float span = b.time - a.time;
+    float t = span > 0.0f ? glm::clamp((time - a.time) / span, 0.0f, 1.0f)
+                          : 1.0f;
+    camera.Position = glm::mix(a.position, b.position, t);
+    camera.Yaw = glm::mix(a.yaw, b.yaw, t);
+    camera.Pitch = glm::mix(a.pitch, b.pitch, t);
+    camera.updateCameraVectors();
+  }
+};
+
+// Per-frame wall-clock frame time and CPU submit time (start of frame to
+// just before the buffer swap), written out as CSV with a summary.
+class FrameStats {
+public:
+  struct Sample {
+    float time; // simulated seconds
+    double frameMs, submitMs;
+  };
+  std::vector<Sample> samples;
+
+  void add(float time, double frameMs, double submitMs) {
+    samples.push_back({time, frameMs, submitMs});
+  }
+
+  // One row per frame to path; min/mean/p95/p99/max of both columns to
+  // <path without .csv>_summary.csv and stdout
+  bool writeCSV(const std::string &path) const {
+    FILE *file = std::fopen(path.c_str(), "w");
+    if (!file) {
+      std::cout << "Could not write benchmark results to " << path
+                << std::endl;
+      return false;
+    }
+    std::fprintf(file, "frame,time_s,frame_ms,cpu_submit_ms\n");
+    for (size_t i = 0; i < samples.size(); i++)
+      std::fprintf(file, "%zu,%.4f,%.4f,%.4f\n", i, samples[i].time,
+                   samples[i].frameMs, samples[i].submitMs);
+    std::fclose(file);
+
+    std::string base = path;
+    if (base.size() > 4 && base.compare(base.size() - 4, 4, ".csv") == 0)
+      base.resize(base.size() - 4);
+    file = std::fopen((base + "_summary.csv").c_str(), "w");
+    if (!file)
+      return false;
+    Summary frame = summarize(&Sample::frameMs);
+    Summary submit = summarize(&Sample::submitMs);
+    std::fprintf(file, "stat,frame_ms,cpu_submit_ms\n");
+    const char *names[] = {"min", "mean", "p95", "p99", "max"};
+    for (int i = 0; i < 5; i++) {
+      std::fprintf(file, "%s,%.4f,%.4f\n", names[i], frame.values[i],
+                   submit.values[i]);
+      std::printf("%-4s frame %8.3f ms   cpu submit %8.3f ms\n", names[i],
+                  frame.values[i], submit.values[i]);
+    }
+    std::fclose(file);
+    std::cout << samples.size() << " frames written to " << path << std::endl;
+    return true;
+  }
+
+private:
+  struct Summary {
+    double values[5]; // min, mean, p95, p99, max
+  };
+
+  Summary summarize(double Sample::*field) const {
+    Summary s = {{0, 0, 0, 0, 0}};
+    if (samples.empty())
+      return s;
+    std::vector<double> sorted;
+    double sum = 0.0;
+    for (const Sample &sample : samples) {
+      sorted.push_back(sample.*field);
+      sum += sample.*field;
+    }
+    std::sort(sorted.begin(), sorted.end());
+    // nearest-rank percentiles
+    auto percentile = [&sorted](double p) {
+      size_t rank = (size_t)std::ceil(p * sorted.size());
+      return sorted[std::min(sorted.size() - 1, rank > 0 ? rank - 1 : 0)];
+    };
+    s.values[0] = sorted.front();
+    s.values[1] = sum / sorted.size();
+    s.values[2] = percentile(0.95);
+    s.values[3] = percentile(0.99);
+    s.values[4] = sorted.back();
+    return s;
+  }
+};
+
+#endif
@@ -0,0 +1,141 @@
+#version 330 core
+// Lighting pass of the deferred path: one full-screen triangle that shades
+// every covered pixel of the G-buffer once. The lantern lights are the
+// clustered lists of fshader.glsl, used here as screen tiles sliced by
+// depth; the spotlight and the lighting model are the same as there.
+out vec4 FragColor;
+
+in vec2 ScreenUV;
+
+struct PointLight {
+    vec3 position;
+    float constant;
+    vec3 ambient;
+    float linear;
+    vec3 diffuse;
+    float quadratic;
+    vec3 specular;
+    float range;
+};
+
+struct SpotLight {
+    vec3 position;
+    vec3 direction;
+    float cutOff;
+    float outerCutOff;
+
+    float constant;
+    float linear;
+    float quadratic;
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+// G-buffer (see GBuffer)
+uniform sampler2D gAlbedo;
+uniform sampler2D gNormal;
+uniform sampler2D gDepth;
+uniform mat4 view;
+uniform mat4 inverseViewProjection;
+
+// Clustered lights, as in fshader.glsl
+#define CLUSTER_X 16
+#define CLUSTER_Y 12
+#define CLUSTER_Z 24
+uniform int numClusteredLights;
+uniform samplerBuffer clusterLights;
+uniform usamplerBuffer clusterData;
+uniform vec2 clusterScale; // tiles per pixel
+uniform vec2 clusterDepth; // slice = log(depth) * x + y
+
+uniform SpotLight spotLight;
+uniform bool spotLightOn;
+uniform vec3 viewPos;
+
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 color);
+vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 color);
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gDepth, pixel, 0).r;
+    // nothing was drawn here; keep the clear colour
+    if (depth == 1.0)
+        discard;
+    // later forward draws (the flames) test against the scene's depth
+    gl_FragDepth = depth;
+
+    vec4 world = inverseViewProjection * vec4(vec3(ScreenUV, depth) * 2.0 - 1.0, 1.0);
+    vec3 fragPos = world.xyz / world.w;
+    vec3 baseColor = texelFetch(gAlbedo, pixel, 0).rgb;
+    vec3 norm = normalize(texelFetch(gNormal, pixel, 0).rgb * 2.0 - 1.0);
+    vec3 viewDir = normalize(viewPos - fragPos);
+
+    ivec2 tile = ivec2(gl_FragCoord.xy * clusterScale);
+    tile = clamp(tile, ivec2(0), ivec2(CLUSTER_X - 1, CLUSTER_Y - 1));
+    float viewDepth = -(view * vec4(fragPos, 1.0)).z;
+    int slice = int(floor(log(max(viewDepth, 1e-4)) * clusterDepth.x + clusterDepth.y));
+    slice = clamp(slice, 0, CLUSTER_Z - 1);
+    int cluster = (slice * CLUSTER_Y + tile.y) * CLUSTER_X + tile.x;
+
+    vec3 result = vec3(0.0);
+    int offset = int(texelFetch(clusterData, cluster * 2).r);
+    int count = int(texelFetch(clusterData, cluster * 2 + 1).r);
+    for (int i = 0; i < count; i++) {
+        int base = int(texelFetch(clusterData, offset + i).r) * 4;
+        vec4 t0 = texelFetch(clusterLights, base);
+        vec4 t1 = texelFetch(clusterLights, base + 1);
+        vec4 t2 = texelFetch(clusterLights, base + 2);
+        vec4 t3 = texelFetch(clusterLights, base + 3);
+        PointLight light = PointLight(t0.xyz, t0.w, t1.xyz, t1.w, t2.xyz, t2.w,
+                                      t3.xyz, t3.w);
+        if (length(light.position - fragPos) < light.range)
+            result += CalcPointLight(light, norm, fragPos, viewDir, baseColor);
+    }
+
+    // Spot Light (Flashlight/Headlight)
+    if (spotLightOn)
+        result += CalcSpotLight(spotLight, norm, fragPos, viewDir, baseColor);
+
+    // Ambient fallback if no lights
+    if (numClusteredLights == 0 && !spotLightOn)
+        result = baseColor * 0.1;
+
+    FragColor = vec4(result, 1.0);
+}
+
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 color)
+{
+    vec3 lightDir = normalize(light.position - fragPos);
+    float diff = max(dot(normal, lightDir), 0.0);
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32.0);
+    float distance = length(light.position - fragPos);
+    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
+
+    vec3 ambient = light.ambient * color;
+    vec3 diffuse = light.diffuse * diff * color;
+    vec3 specular = light.specular * spec;
+    return (ambient + diffuse + specular) * attenuation;
+}
+
+vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 color)
+{
+    vec3 lightDir = normalize(light.position - fragPos);
+    float diff = max(dot(normal, lightDir), 0.0);
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32.0);
+    float distance = length(light.position - fragPos);
+    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
+
+    float theta = dot(lightDir, normalize(-light.direction));
+    float epsilon = light.cutOff - light.outerCutOff;
+    float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
+
+    vec3 ambient = light.ambient * color;
+    vec3 diffuse = light.diffuse * diff * color;
+    vec3 specular = light.specular * spec;
+    return (ambient + diffuse + specular) * attenuation * intensity;
+}
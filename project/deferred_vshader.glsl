@@ -0,0 +1,10 @@
+#version 330 core
+// Full-screen triangle for the deferred lighting pass, no vertex buffer:
+// vertices 0, 1, 2 land on (0,0), (2,0) and (0,2) in screen UV
+out vec2 ScreenUV;
+
+void main()
+{
+    ScreenUV = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(ScreenUV * 2.0 - 1.0, 0.0, 1.0);
+}
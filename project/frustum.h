@@ -0,0 +1,136 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define FRUSTUM_SSE
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define FRUSTUM_NEON
+#endif
+
+// Axis-aligned bounding box in world space
+struct AABB {
+  glm::vec3 min, max;
+
+  void expand(const AABB &other) {
+    min = glm::min(min, other.min);
+    max = glm::max(max, other.max);
+  }
+};
+
+// true if the boxes share any point
+inline bool overlaps(const AABB &a, const AABB &b) {
+  return a.min.x <= b.max.x && a.min.y <= b.max.y && a.min.z <= b.max.z &&
+         b.min.x <= a.max.x && b.min.y <= a.max.y && b.min.z <= a.max.z;
+}
+
+// World bounds of the unit cube (-0.5..0.5) placed by model
+inline AABB cubeBounds(const glm::mat4 &model) {
+  glm::vec3 center(model[3]);
+  glm::vec3 extent = 0.5f * (glm::abs(glm::vec3(model[0])) +
+                             glm::abs(glm::vec3(model[1])) +
+                             glm::abs(glm::vec3(model[2])));
+  return {center - extent, center + extent};
+}
+
+// The six planes of a view-projection matrix (Gribb/Hartmann), normals
+// pointing inwards, optionally narrowed to the screen rectangle rect
+// (x0, y0, x1, y1 in NDC). The planes are stored component by component,
+// padded to eight with planes nothing is outside of, so a box is tested
+// against four planes per SSE/NEON instruction.
+class Frustum {
+public:
+  Frustum(const glm::mat4 &viewProjection,
+          const glm::vec4 &rect = glm::vec4(-1.0f, -1.0f, 1.0f, 1.0f)) {
+    const glm::mat4 &m = viewProjection;
+    glm::vec4 rowX(m[0][0], m[1][0], m[2][0], m[3][0]);
+    glm::vec4 rowY(m[0][1], m[1][1], m[2][1], m[3][1]);
+    glm::vec4 rowZ(m[0][2], m[1][2], m[2][2], m[3][2]);
+    glm::vec4 rowW(m[0][3], m[1][3], m[2][3], m[3][3]);
+    glm::vec4 planes[6] = {rowX - rect.x * rowW, rect.z * rowW - rowX,
+                           rowY - rect.y * rowW, rect.w * rowW - rowY,
+                           rowW + rowZ,          rowW - rowZ};
+    for (int i = 0; i < 8; i++) {
+      glm::vec4 p(0.0f, 0.0f, 0.0f, 1.0f);
+      if (i < 6)
+        p = planes[i] / glm::length(glm::vec3(planes[i]));
+      nx[i] = p.x;
+      ny[i] = p.y;
+      nz[i] = p.z;
+      d[i] = p.w;
+    }
+  }
+
+  // false only if the box is entirely outside one of the planes; boxes
+  // near a frustum corner may pass without being visible
+  bool intersects(const AABB &box) const {
+    glm::vec3 c = 0.5f * (box.min + box.max);
+    glm::vec3 e = 0.5f * (box.max - box.min);
+    return intersects(c, e);
+  }
+
+private:
+  alignas(16) float nx[8], ny[8], nz[8], d[8];
+
+  // center c, half extents e: outside a plane when the signed distance of
+  // the center is below minus the box's projected radius on the normal
+  bool intersects(const glm::vec3 &c, const glm::vec3 &e) const {
+#if defined(FRUSTUM_SSE)
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    __m128 cx = _mm_set1_ps(c.x), cy = _mm_set1_ps(c.y), cz = _mm_set1_ps(c.z);
+    __m128 ex = _mm_set1_ps(e.x), ey = _mm_set1_ps(e.y), ez = _mm_set1_ps(e.z);
+    for (int i = 0; i < 8; i += 4) {
+      __m128 px = _mm_load_ps(nx + i), py = _mm_load_ps(ny + i),
+             pz = _mm_load_ps(nz + i);
+      __m128 dist = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(px, cx), _mm_mul_ps(py, cy)),
+          _mm_add_ps(_mm_mul_ps(pz, cz), _mm_load_ps(d + i)));
+      __m128 radius = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(_mm_andnot_ps(sign, px), ex),
+                     _mm_mul_ps(_mm_andnot_ps(sign, py), ey)),
+          _mm_mul_ps(_mm_andnot_ps(sign, pz), ez));
+      if (_mm_movemask_ps(
+              _mm_cmplt_ps(_mm_add_ps(dist, radius), _mm_setzero_ps())))
+        return false;
+    }
+    return true;
+#elif defined(FRUSTUM_NEON)
+    float32x4_t cx = vdupq_n_f32(c.x), cy = vdupq_n_f32(c.y),
+                cz = vdupq_n_f32(c.z);
+    float32x4_t ex = vdupq_n_f32(e.x), ey = vdupq_n_f32(e.y),
+                ez = vdupq_n_f32(e.z);
+    for (int i = 0; i < 8; i += 4) {
+      float32x4_t px = vld1q_f32(nx + i), py = vld1q_f32(ny + i),
+                  pz = vld1q_f32(nz + i);
+      float32x4_t dist = vld1q_f32(d + i);
+      dist = vmlaq_f32(dist, px, cx);
+      dist = vmlaq_f32(dist, py, cy);
+      dist = vmlaq_f32(dist, pz, cz);
+      dist = vmlaq_f32(dist, vabsq_f32(px), ex);
+      dist = vmlaq_f32(dist, vabsq_f32(py), ey);
+      dist = vmlaq_f32(dist, vabsq_f32(pz), ez);
+      uint32x4_t outside = vcltq_f32(dist, vdupq_n_f32(0.0f));
+      uint32x2_t any = vorr_u32(vget_low_u32(outside), vget_high_u32(outside));
+      if (vget_lane_u32(vpmax_u32(any, any), 0))
+        return false;
+    }
+    return true;
+#else
+    for (int i = 0; i < 6; i++) {
+      float dist = nx[i] * c.x + ny[i] * c.y + nz[i] * c.z + d[i];
+      float radius = std::fabs(nx[i]) * e.x + std::fabs(ny[i]) * e.y +
+                     std::fabs(nz[i]) * e.z;
+      if (dist + radius < 0.0f)
+        return false;
+    }
+    return true;
+#endif
+  }
+};
+
+#endif
@@ -1,16 +1,18 @@
 #version 330 core
 out vec4 FragColor;
 
+// Field order packs each float into the padding after a vec3, so the std140
+// layout matches PointLightStd140 in light_buffer.h (64 bytes per light).
+// The clustered path reads the same 64 bytes as four texels.
 struct PointLight {
     vec3 position;
-    
     float constant;
-    float linear;
-    float quadratic;
-    
     vec3 ambient;
+    float linear;
     vec3 diffuse;
+    float quadratic;
     vec3 specular;
+    float range;
 };
 
 struct SpotLight {
@@ -32,16 +34,43 @@ in vec3 FragPos;
 in vec2 TexCoords;
 in vec3 Normal;
 in mat3 TBN;
+in vec2 UVScale;
+in vec3 ObjectColor;
+flat in float Layer;
+in float ViewDepth;
+
+#define MAX_POINT_LIGHTS 16
+
+// Lantern lights, written by LightBuffer in one glBufferSubData per frame
+layout (std140) uniform LightBlock {
+    int numPointLights;
+    PointLight pointLights[MAX_POINT_LIGHTS];
+};
+
+// Clustered lights, written by LightClusters; CLUSTER_X/Y/Z must match
+// light_clusters.h. clusterLights holds four texels per light; clusterData
+// holds an (offset, count) pair per cluster followed by the light indices.
+#define CLUSTER_X 16
+#define CLUSTER_Y 12
+#define CLUSTER_Z 24
+uniform bool useClusters;
+uniform int numClusteredLights;
+uniform samplerBuffer clusterLights;
+uniform usamplerBuffer clusterData;
+uniform vec2 clusterScale; // tiles per pixel
+uniform vec2 clusterDepth; // slice = log(depth) * x + y
+
+// Bit i set if pointLights[i] reaches the current draw (set per draw from
+// the CPU's light culling); unused by the clustered path
+uniform int drawLightMask;
 
-uniform int numPointLights;
-uniform PointLight pointLights[16]; // Increased limit to 16 lights
 uniform SpotLight spotLight;
 uniform bool spotLightOn;
 
 uniform vec3 viewPos;
-uniform vec3 objectColor;
 uniform bool useTexture;
-uniform sampler2D texture1;
+// Tomb materials, one layer each (see TextureArray)
+uniform sampler2DArray textureLayers;
 uniform sampler2D normalMap;
 uniform bool useNormalMap;
 
@@ -49,9 +78,8 @@ uniform bool useNormalMap;
 uniform bool useEmissive;
 uniform vec3 emissiveColor;
 
-uniform vec2 uvScale;
-
 vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 color);
+vec3 CalcClusteredLights(vec3 normal, vec3 fragPos, vec3 viewDir, vec3 color);
 vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 color);
 
 void main()
@@ -63,7 +91,7 @@ void main()
     }
 
     vec3 norm = normalize(Normal);
-    vec2 scaledTexCoords = TexCoords * uvScale;
+    vec2 scaledTexCoords = TexCoords * UVScale;
     if (useNormalMap) {
         norm = texture(normalMap, scaledTexCoords).rgb;
         norm = norm * 2.0 - 1.0;   
@@ -72,23 +100,30 @@ void main()
     
     vec3 viewDir = normalize(viewPos - FragPos);
     
-    vec3 baseColor = objectColor;
+    vec3 baseColor = ObjectColor;
     if (useTexture) {
-        baseColor = texture(texture1, scaledTexCoords).rgb;
+        baseColor = texture(textureLayers, vec3(scaledTexCoords, Layer)).rgb;
     }
     
     vec3 result = vec3(0.0);
     
     // Point Lights
-    for(int i = 0; i < numPointLights; i++)
-        result += CalcPointLight(pointLights[i], norm, FragPos, viewDir, baseColor);
+    int lightTotal = numPointLights;
+    if (useClusters) {
+        result += CalcClusteredLights(norm, FragPos, viewDir, baseColor);
+        lightTotal = numClusteredLights;
+    } else {
+        for(int i = 0; i < numPointLights; i++)
+            if ((drawLightMask & (1 << i)) != 0)
+                result += CalcPointLight(pointLights[i], norm, FragPos, viewDir, baseColor);
+    }
         
     // Spot Light (Flashlight/Headlight)
     if (spotLightOn)
         result += CalcSpotLight(spotLight, norm, FragPos, viewDir, baseColor);
      
     // Ambient fallback if no lights
-    if (numPointLights == 0 && !spotLightOn)
+    if (lightTotal == 0 && !spotLightOn)
         result = baseColor * 0.1;
         
     FragColor = vec4(result, 1.0);
@@ -121,6 +156,33 @@ vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, v
     return (ambient + diffuse + specular);
 }
 
+// Only the lights binned into this fragment's cluster, and of those only the
+// ones whose range reaches it, so the cut-off is a sphere, not a froxel
+vec3 CalcClusteredLights(vec3 normal, vec3 fragPos, vec3 viewDir, vec3 color)
+{
+    ivec2 tile = ivec2(gl_FragCoord.xy * clusterScale);
+    tile = clamp(tile, ivec2(0), ivec2(CLUSTER_X - 1, CLUSTER_Y - 1));
+    int slice = int(floor(log(max(ViewDepth, 1e-4)) * clusterDepth.x + clusterDepth.y));
+    slice = clamp(slice, 0, CLUSTER_Z - 1);
+    int cluster = (slice * CLUSTER_Y + tile.y) * CLUSTER_X + tile.x;
+
+    int offset = int(texelFetch(clusterData, cluster * 2).r);
+    int count = int(texelFetch(clusterData, cluster * 2 + 1).r);
+    vec3 result = vec3(0.0);
+    for (int i = 0; i < count; i++) {
+        int base = int(texelFetch(clusterData, offset + i).r) * 4;
+        vec4 t0 = texelFetch(clusterLights, base);
+        vec4 t1 = texelFetch(clusterLights, base + 1);
+        vec4 t2 = texelFetch(clusterLights, base + 2);
+        vec4 t3 = texelFetch(clusterLights, base + 3);
+        PointLight light = PointLight(t0.xyz, t0.w, t1.xyz, t1.w, t2.xyz, t2.w,
+                                      t3.xyz, t3.w);
+        if (length(light.position - fragPos) < light.range)
+            result += CalcPointLight(light, normal, fragPos, viewDir, color);
+    }
+    return result;
+}
+
 vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 color)
 {
     vec3 lightDir = normalize(light.position - fragPos);
@@ -0,0 +1,113 @@
+#ifndef GBUFFER_H
+#define GBUFFER_H
+
+#include <GL/glew.h>
+
+#include <iostream>
+
+// Render targets for the deferred path: the geometry pass writes each
+// pixel's surface once, and the lighting pass shades it once, however much
+// was drawn over it.
+//   albedo  RGBA8       base colour (texture or object colour)
+//   normal  RGB10_A2    world normal, stored as n * 0.5 + 0.5
+//   depth   DEPTH24_STENCIL8, sampled to rebuild the world position
+// The targets are reallocated whenever the framebuffer size changes.
+class GBuffer {
+public:
+  unsigned int FBO = 0, albedo = 0, normal = 0, depth = 0;
+  int width = 0, height = 0;
+
+  GBuffer() {
+    glGenFramebuffers(1, &FBO);
+    glGenVertexArrays(1, &emptyVAO);
+  }
+
+  ~GBuffer() {
+    deleteTextures();
+    glDeleteFramebuffers(1, &FBO);
+    glDeleteVertexArrays(1, &emptyVAO);
+  }
+
+  GBuffer(const GBuffer &) = delete;
+  GBuffer &operator=(const GBuffer &) = delete;
+
+  // Bind for the geometry pass at the given size and clear it
+  void bindForGeometry(int w, int h) {
+    if (w != width || h != height)
+      allocate(w, h);
+    glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+    glViewport(0, 0, width, height);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  }
+
+  // albedo, normal and depth on firstUnit, firstUnit + 1 and firstUnit + 2
+  void bindTextures(unsigned int firstUnit) const {
+    unsigned int textures[3] = {albedo, normal, depth};
+    for (int i = 0; i < 3; i++) {
+      glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+      glBindTexture(GL_TEXTURE_2D, textures[i]);
+    }
+    glActiveTexture(GL_TEXTURE0);
+  }
+
+  // One triangle covering the screen, its corners made from gl_VertexID
+  // (see deferred_vshader.glsl); core profile still wants a VAO bound
+  void drawFullscreen() const {
+    glBindVertexArray(emptyVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+  }
+
+private:
+  unsigned int emptyVAO = 0;
+
+  static unsigned int makeTarget(GLenum internalFormat, GLenum format,
+                                 GLenum type, int w, int h) {
+    unsigned int texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, w, h, 0, format, type,
+                 nullptr);
+    // read back with texelFetch-like lookups, one texel per pixel
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    return texture;
+  }
+
+  void allocate(int w, int h) {
+    deleteTextures();
+    width = w;
+    height = h;
+    albedo = makeTarget(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, w, h);
+    normal = makeTarget(GL_RGB10_A2, GL_RGBA, GL_UNSIGNED_INT_2_10_10_10_REV,
+                        w, h);
+    depth = makeTarget(GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL,
+                       GL_UNSIGNED_INT_24_8, w, h);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                           albedo, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D,
+                           normal, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                           GL_TEXTURE_2D, depth, 0);
+    GLenum drawBuffers[2] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+    glDrawBuffers(2, drawBuffers);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+      std::cout << "G-buffer is incomplete" << std::endl;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  }
+
+  void deleteTextures() {
+    unsigned int textures[3] = {albedo, normal, depth};
+    for (unsigned int texture : textures)
+      if (texture)
+        glDeleteTextures(1, &texture);
+    albedo = normal = depth = 0;
+  }
+};
+
+#endif
@@ -0,0 +1,38 @@
+#version 330 core
+// Geometry pass of the deferred path: the surface inputs of fshader.glsl,
+// written to the G-buffer unlit (see GBuffer)
+layout (location = 0) out vec4 GAlbedo;
+layout (location = 1) out vec4 GNormal;
+
+in vec3 FragPos;
+in vec2 TexCoords;
+in vec3 Normal;
+in mat3 TBN;
+in vec2 UVScale;
+in vec3 ObjectColor;
+flat in float Layer;
+
+uniform bool useTexture;
+// Tomb materials, one layer each (see TextureArray)
+uniform sampler2DArray textureLayers;
+uniform sampler2D normalMap;
+uniform bool useNormalMap;
+
+void main()
+{
+    vec3 norm = normalize(Normal);
+    vec2 scaledTexCoords = TexCoords * UVScale;
+    if (useNormalMap) {
+        norm = texture(normalMap, scaledTexCoords).rgb;
+        norm = norm * 2.0 - 1.0;
+        norm = normalize(TBN * norm);
+    }
+
+    vec3 baseColor = ObjectColor;
+    if (useTexture) {
+        baseColor = texture(textureLayers, vec3(scaledTexCoords, Layer)).rgb;
+    }
+
+    GAlbedo = vec4(baseColor, 1.0);
+    GNormal = vec4(norm * 0.5 + 0.5, 1.0);
+}
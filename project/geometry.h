@@ -3,16 +3,39 @@
 #define GEOMETRY_H
 
 #include <GL/glew.h>
+#include <algorithm>
 #include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
 #include <vector>
 
+class CubeInstanceBatch;
+
+// Packed cube vertex: float position, 10:10:10:2 signed-normalised normal
+// and tangent, half-float texcoord. 24 bytes instead of 44.
+struct PackedVertex {
+  float position[3];
+  uint32_t normal;
+  uint16_t texCoord[2];
+  uint32_t tangent;
+};
+static_assert(sizeof(PackedVertex) == 24, "packed cube vertex is 24 bytes");
+
 // Standard Cube with Normals and TexCoords and Tangents
 class Cube {
 public:
-  unsigned int VAO, VBO;
+  unsigned int VAO, VBO, EBO;
+  // Vertex format in VBO: 11 floats, or PackedVertex when packed
+  bool packed;
+  // CPU copy of the 24 unique vertices (11 floats each) and 36 indices, for
+  // baking merged meshes
+  std::vector<float> vertexData;
+  std::vector<unsigned short> indices;
 
-  Cube() {
+  Cube(bool packed = false) : packed(packed) {
     // positions (3), normals (3), texcoords (2), tangents (3)
     // Calculated tangents for normal mapping
     // 14 floats per vertex
@@ -99,11 +122,66 @@ public:
         -0.5f, 0.5f, 0.5f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f,
         0.0f // bottom-left
     };
+    // Each corner is listed once per triangle; collapse the 36 listed
+    // vertices to the 24 unique ones (4 per face) plus an index list.
+    for (int v = 0; v < 36; v++) {
+      const float *vertex = &vertices[v * 11];
+      int found = -1;
+      for (size_t u = 0; u < vertexData.size() / 11; u++) {
+        if (std::memcmp(&vertexData[u * 11], vertex, 11 * sizeof(float)) ==
+            0) {
+          found = (int)u;
+          break;
+        }
+      }
+      if (found < 0) {
+        found = (int)(vertexData.size() / 11);
+        vertexData.insert(vertexData.end(), vertex, vertex + 11);
+      }
+      indices.push_back((unsigned short)found);
+    }
+
     glGenVertexArrays(1, &VAO);
     glGenBuffers(1, &VBO);
+    glGenBuffers(1, &EBO);
     glBindVertexArray(VAO);
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    if (packed) {
+      std::vector<PackedVertex> packedData = packVertices();
+      glBufferData(GL_ARRAY_BUFFER, packedData.size() * sizeof(PackedVertex),
+                   packedData.data(), GL_STATIC_DRAW);
+    } else {
+      glBufferData(GL_ARRAY_BUFFER, vertexData.size() * sizeof(float),
+                   vertexData.data(), GL_STATIC_DRAW);
+    }
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                 indices.size() * sizeof(unsigned short), indices.data(),
+                 GL_STATIC_DRAW);
+    setVertexAttributes(packed);
+    glBindVertexArray(0);
+  }
+
+  // attribute layout for the bound VBO; shared with instance batch VAOs and
+  // merged meshes. Locations 0-3 are the same in both formats, so
+  // vshader.glsl does not care which one it is fed.
+  static void setVertexAttributes(bool packed = false) {
+    if (packed) {
+      GLsizei stride = sizeof(PackedVertex);
+      glEnableVertexAttribArray(0);
+      glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride,
+                            (void *)offsetof(PackedVertex, position));
+      glEnableVertexAttribArray(1);
+      glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride,
+                            (void *)offsetof(PackedVertex, normal));
+      glEnableVertexAttribArray(2);
+      glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, stride,
+                            (void *)offsetof(PackedVertex, texCoord));
+      glEnableVertexAttribArray(3);
+      glVertexAttribPointer(3, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride,
+                            (void *)offsetof(PackedVertex, tangent));
+      return;
+    }
     // position
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(float),
@@ -120,121 +198,180 @@ public:
     glEnableVertexAttribArray(3);
     glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(float),
                           (void *)(8 * sizeof(float)));
-    glBindVertexArray(0);
   }
 
   void draw(unsigned int shaderProgram) {
     glBindVertexArray(VAO);
-    glDrawArrays(GL_TRIANGLES, 0, 36);
+    glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_SHORT, 0);
     glBindVertexArray(0);
   }
+
+  // one glDrawElementsInstanced for every cube in the batch, or for the
+  // instances [first, first + count) of it
+  void drawInstanced(CubeInstanceBatch &batch);
+  void drawInstanced(CubeInstanceBatch &batch, int first, int count);
+
+private:
+  std::vector<PackedVertex> packVertices() const {
+    std::vector<PackedVertex> out(vertexData.size() / 11);
+    for (size_t v = 0; v < out.size(); v++) {
+      const float *in = &vertexData[v * 11];
+      PackedVertex &p = out[v];
+      p.position[0] = in[0];
+      p.position[1] = in[1];
+      p.position[2] = in[2];
+      p.normal = glm::packSnorm3x10_1x2(glm::vec4(in[3], in[4], in[5], 0.0f));
+      p.texCoord[0] = glm::packHalf1x16(in[6]);
+      p.texCoord[1] = glm::packHalf1x16(in[7]);
+      p.tangent = glm::packSnorm3x10_1x2(glm::vec4(in[8], in[9], in[10], 0.0f));
+    }
+    return out;
+  }
 };
 
-class Cylinder {
-public:
-  unsigned int VAO, VBO, EBO;
-  int indexCount;
+// Per-instance attributes read by vshader.glsl when useInstancing is set:
+// model at locations 4-7, uvScale at 8, color at 9.
+struct CubeInstance {
+  glm::mat4 model;
+  glm::vec2 uvScale;
+  glm::vec3 color;
+  float layer; // texture array layer
+};
 
-  Cylinder(int segments = 36) {
-    std::vector<float> vertices;
-    std::vector<unsigned int> indices;
-    float radius = 0.5f;
-    float height = 1.0f;
-    float halfHeight = height / 2.0f;
+// A list of cube instances with its own VAO: the cube's vertex buffer for
+// attributes 0-3 plus an instance buffer stepped once per instance.
+class CubeInstanceBatch {
+public:
+  unsigned int VAO, instanceVBO;
+  std::vector<CubeInstance> instances;
 
-    // Side vertices
-    for (int i = 0; i <= segments; ++i) {
-      float theta = (float)i / (float)segments * 2.0f * 3.14159f;
-      float x = cos(theta) * radius;
-      float z = sin(theta) * radius;
-      float u = (float)i / (float)segments;
+  CubeInstanceBatch(const Cube &cube) {
+    glGenVertexArrays(1, &VAO);
+    glGenBuffers(1, &instanceVBO);
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, cube.VBO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cube.EBO);
+    Cube::setVertexAttributes(cube.packed);
 
-      // Top edge
-      vertices.push_back(x);
-      vertices.push_back(halfHeight);
-      vertices.push_back(z); // Pos
-      vertices.push_back(x);
-      vertices.push_back(0.0f);
-      vertices.push_back(z); // Normal
-      vertices.push_back(u);
-      vertices.push_back(1.0f); // Tex
-      // Tangent
-      vertices.push_back(-sin(theta));
-      vertices.push_back(0.0f);
-      vertices.push_back(cos(theta));
-
-      // Bottom edge
-      vertices.push_back(x);
-      vertices.push_back(-halfHeight);
-      vertices.push_back(z); // Pos
-      vertices.push_back(x);
-      vertices.push_back(0.0f);
-      vertices.push_back(z); // Normal
-      vertices.push_back(u);
-      vertices.push_back(0.0f); // Tex
-                                // Tangent
-      vertices.push_back(-sin(theta));
-      vertices.push_back(0.0f);
-      vertices.push_back(cos(theta));
+    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+    for (int loc = 4; loc <= 10; loc++) {
+      glEnableVertexAttribArray(loc);
+      glVertexAttribDivisor(loc, 1);
     }
+    pointInstanceAttributes(0);
+    glBindVertexArray(0);
+    baseInstance = 0;
+  }
 
-    // Side indices
-    for (int i = 0; i < segments; ++i) {
-      indices.push_back(i * 2);
-      indices.push_back(i * 2 + 1);
-      indices.push_back((i + 1) * 2);
+  void add(const glm::mat4 &model, glm::vec2 uvScale, glm::vec3 color,
+           float layer = 0.0f) {
+    instances.push_back({model, uvScale, color, layer});
+  }
 
-      indices.push_back((i + 1) * 2);
-      indices.push_back(i * 2 + 1);
-      indices.push_back((i + 1) * 2 + 1);
-    }
+  // copy the instance list to the GPU; static batches do this once
+  void upload() {
+    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+    glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(CubeInstance),
+                 instances.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
 
-    // Top and Bottom caps (Simplified, flat normals)
-    // For brevity, skipping cap detailed implementation or adding simple center
-    // fan Add Top Cap Center
-    int topCenterIdx = vertices.size() / 11;
-    vertices.push_back(0.0f);
-    vertices.push_back(halfHeight);
-    vertices.push_back(0.0f); // Pos
-    vertices.push_back(0.0f);
-    vertices.push_back(1.0f);
-    vertices.push_back(0.0f); // Norm
-    vertices.push_back(0.5f);
-    vertices.push_back(0.5f); // Tex
-    vertices.push_back(1.0f);
-    vertices.push_back(0.0f);
-    vertices.push_back(0.0f); // Tangent
-
-    // Add Tops
-    for (int i = 0; i < segments; ++i) {
-      float theta = (float)i / (float)segments * 2.0f * 3.14159f;
-      float x = cos(theta) * radius;
-      float z = sin(theta) * radius;
-      // Add rim vertex again with UP normal
-      vertices.push_back(x);
-      vertices.push_back(halfHeight);
-      vertices.push_back(z);
-      vertices.push_back(0.0f);
-      vertices.push_back(1.0f);
-      vertices.push_back(0.0f);
-      vertices.push_back(x + 0.5f);
-      vertices.push_back(z + 0.5f); // Simple Planar mapping
-      vertices.push_back(1.0f);
-      vertices.push_back(0.0f);
-      vertices.push_back(0.0f);
-
-      if (i < segments) {
-        // Triangle fan
-        // Center is topCenterIdx
-        // Current rim is topCenterIdx + 1 + i
-        // Next rim is topCenterIdx + 1 + i + 1
-      }
-    }
-    // ... Just sides for now is safer to avoid complexity unless required.
-    // Re-implementing simplified Cylinder using basic mesh logic for
-    // robustness.
+  // bind the VAO with instance 0 of the next draw reading `first`. GL 3.3
+  // has no base-instance draw, so the per-instance pointers are moved
+  // instead, and only when the start actually changes.
+  void bind(int first) {
+    glBindVertexArray(VAO);
+    if (first == baseInstance)
+      return;
+    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+    pointInstanceAttributes(first);
+    baseInstance = first;
+  }
 
-    indexCount = indices.size();
+private:
+  int baseInstance;
+
+  void pointInstanceAttributes(int first) {
+    GLsizei stride = sizeof(CubeInstance);
+    size_t base = first * sizeof(CubeInstance);
+    for (int col = 0; col < 4; col++)
+      glVertexAttribPointer(4 + col, 4, GL_FLOAT, GL_FALSE, stride,
+                            (void *)(base + col * sizeof(glm::vec4)));
+    glVertexAttribPointer(8, 2, GL_FLOAT, GL_FALSE, stride,
+                          (void *)(base + offsetof(CubeInstance, uvScale)));
+    glVertexAttribPointer(9, 3, GL_FLOAT, GL_FALSE, stride,
+                          (void *)(base + offsetof(CubeInstance, color)));
+    glVertexAttribPointer(10, 1, GL_FLOAT, GL_FALSE, stride,
+                          (void *)(base + offsetof(CubeInstance, layer)));
+  }
+};
+
+inline void Cube::drawInstanced(CubeInstanceBatch &batch) {
+  drawInstanced(batch, 0, (int)batch.instances.size());
+}
+
+inline void Cube::drawInstanced(CubeInstanceBatch &batch, int first,
+                                int count) {
+  if (count <= 0)
+    return;
+  batch.bind(first);
+  glDrawElementsInstanced(GL_TRIANGLES, 36, GL_UNSIGNED_SHORT, 0, count);
+  glBindVertexArray(0);
+}
+
+// One level of detail of a generated mesh: a range of the mesh's shared
+// index buffer. The curved surface comes first so it can be drawn on its
+// own, followed by the caps.
+struct MeshLod {
+  int segments;
+  int firstIndex;
+  int sideCount;  // indices of the curved surface
+  int indexCount; // sides plus caps
+};
+
+// Diameter in pixels of a bounding sphere of localRadius around the model
+// origin. projScale is projection[1][1] * viewport height / 2.
+inline float projectedDiameter(const glm::mat4 &model, float localRadius,
+                               const glm::mat4 &view, float projScale) {
+  float scale = std::max(glm::length(glm::vec3(model[0])),
+                         std::max(glm::length(glm::vec3(model[1])),
+                                  glm::length(glm::vec3(model[2]))));
+  float depth = -(view * model[3]).z;
+  if (depth <= 0.0f)
+    return 0.0f;
+  return 2.0f * localRadius * scale * projScale / depth;
+}
+
+// Coarsest LOD whose silhouette stays within half a pixel of the true circle.
+// A chord over 2*pi/n of a circle of r pixels sags by r * (pi/n)^2 / 2, so n
+// must be at least pi * sqrt(r).
+inline int selectLod(const std::vector<MeshLod> &lods, float pixels) {
+  float needed = 3.14159f * std::sqrt(std::max(pixels, 0.0f) * 0.5f);
+  for (int i = (int)lods.size() - 1; i > 0; i--)
+    if ((float)lods[i].segments >= needed)
+      return i;
+  return 0;
+}
+
+// Unit-height, 0.5-radius cylinder. Every LOD (segments, segments / 2, ...)
+// lives in one VBO/EBO pair and is picked per draw by index range.
+class Cylinder {
+public:
+  unsigned int VAO, VBO, EBO;
+  std::vector<MeshLod> lods;
+
+  // bounding sphere radius in model space, for projectedDiameter
+  static constexpr float BOUNDING_RADIUS = 0.70711f;
+
+  Cylinder(int segments = 36, int lodCount = 3) {
+    std::vector<float> vertices;
+    std::vector<unsigned int> indices;
+    for (int i = 0; i < lodCount; i++) {
+      int lodSegments = std::max(6, segments >> i);
+      if (i > 0 && lodSegments == lods.back().segments)
+        break;
+      lods.push_back(generate(vertices, indices, lodSegments));
+    }
 
     glGenVertexArrays(1, &VAO);
     glGenBuffers(1, &VBO);
@@ -250,27 +387,95 @@ public:
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int),
                  &indices[0], GL_STATIC_DRAW);
 
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(float),
-                          (void *)0);
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(float),
-                          (void *)(3 * sizeof(float)));
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 11 * sizeof(float),
-                          (void *)(6 * sizeof(float)));
-    glEnableVertexAttribArray(3);
-    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(float),
-                          (void *)(8 * sizeof(float)));
+    Cube::setVertexAttributes();
 
     glBindVertexArray(0);
   }
 
-  void draw(unsigned int shaderProgram) {
+  int selectLod(float pixels) const { return ::selectLod(lods, pixels); }
+
+  // caps = false leaves the ends open (the lantern cup, the flame shells)
+  void draw(unsigned int shaderProgram, int lod = 0, bool caps = true) {
+    const MeshLod &l = lods[lod];
     glBindVertexArray(VAO);
-    glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
+    glDrawElements(GL_TRIANGLES, caps ? l.indexCount : l.sideCount,
+                   GL_UNSIGNED_INT,
+                   (void *)(l.firstIndex * sizeof(unsigned int)));
     glBindVertexArray(0);
   }
+
+private:
+  static void pushVertex(std::vector<float> &v, glm::vec3 pos, glm::vec3 normal,
+                         glm::vec2 uv, glm::vec3 tangent) {
+    float out[11] = {pos.x,    pos.y,    pos.z,     normal.x,
+                     normal.y, normal.z, uv.x,      uv.y,
+                     tangent.x, tangent.y, tangent.z};
+    v.insert(v.end(), out, out + 11);
+  }
+
+  // Append one LOD: the side strip, then a fan for each cap with its own rim
+  // vertices so the caps get flat normals.
+  static MeshLod generate(std::vector<float> &vertices,
+                          std::vector<unsigned int> &indices, int segments) {
+    const float radius = 0.5f;
+    const float halfHeight = 0.5f;
+    MeshLod lod;
+    lod.segments = segments;
+    lod.firstIndex = (int)indices.size();
+    unsigned int base = (unsigned int)(vertices.size() / 11);
+
+    // Side vertices, top and bottom edge per column
+    for (int i = 0; i <= segments; ++i) {
+      float theta = (float)i / (float)segments * 2.0f * 3.14159f;
+      float x = cos(theta) * radius;
+      float z = sin(theta) * radius;
+      float u = (float)i / (float)segments;
+      glm::vec3 normal(x, 0.0f, z);
+      glm::vec3 tangent(-sin(theta), 0.0f, cos(theta));
+      pushVertex(vertices, glm::vec3(x, halfHeight, z), normal,
+                 glm::vec2(u, 1.0f), tangent);
+      pushVertex(vertices, glm::vec3(x, -halfHeight, z), normal,
+                 glm::vec2(u, 0.0f), tangent);
+    }
+    for (int i = 0; i < segments; ++i) {
+      unsigned int top = base + i * 2, next = base + (i + 1) * 2;
+      indices.push_back(top);
+      indices.push_back(top + 1);
+      indices.push_back(next);
+
+      indices.push_back(next);
+      indices.push_back(top + 1);
+      indices.push_back(next + 1);
+    }
+    lod.sideCount = (int)indices.size() - lod.firstIndex;
+
+    // Caps: centre followed by the rim, planar-mapped texcoords
+    for (int cap = 0; cap < 2; cap++) {
+      float y = cap == 0 ? halfHeight : -halfHeight;
+      glm::vec3 normal(0.0f, cap == 0 ? 1.0f : -1.0f, 0.0f);
+      glm::vec3 tangent(1.0f, 0.0f, 0.0f);
+      unsigned int centre = (unsigned int)(vertices.size() / 11);
+      pushVertex(vertices, glm::vec3(0.0f, y, 0.0f), normal,
+                 glm::vec2(0.5f, 0.5f), tangent);
+      for (int i = 0; i < segments; ++i) {
+        float theta = (float)i / (float)segments * 2.0f * 3.14159f;
+        float x = cos(theta) * radius;
+        float z = sin(theta) * radius;
+        pushVertex(vertices, glm::vec3(x, y, z), normal,
+                   glm::vec2(x + 0.5f, z + 0.5f), tangent);
+      }
+      // counter-clockwise seen from outside the cap
+      for (int i = 0; i < segments; ++i) {
+        unsigned int rim = centre + 1 + i;
+        unsigned int next = centre + 1 + (i + 1) % segments;
+        indices.push_back(centre);
+        indices.push_back(cap == 0 ? next : rim);
+        indices.push_back(cap == 0 ? rim : next);
+      }
+    }
+    lod.indexCount = (int)indices.size() - lod.firstIndex;
+    return lod;
+  }
 };
 
 #endif
@@ -0,0 +1,152 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Command line for unattended runs:
+//   --headless          offscreen context, render into an FBO
+//   --frames N          stop after N frames (0 = until closed)
+//   --capture DIR       write every frame to DIR/frame_NNNN.ppm
+//   --capture-every K   ...or only every Kth frame
+//   --benchmark FILE    play the scripted benchmark and write frame times
+//                       to FILE (CSV)
+//   --trace FILE        write per-section CPU/GPU timings of every frame to
+//                       FILE as a Chrome trace (JSON)
+struct HeadlessOptions {
+  bool enabled = false;
+  int frames = 0;
+  std::string captureDir;
+  int captureEvery = 1;
+  std::string benchmarkCsv;
+  std::string traceJson;
+
+  static HeadlessOptions parse(int argc, char **argv) {
+    HeadlessOptions opts;
+    for (int i = 1; i < argc; i++) {
+      bool hasValue = i + 1 < argc;
+      if (std::strcmp(argv[i], "--headless") == 0)
+        opts.enabled = true;
+      else if (std::strcmp(argv[i], "--frames") == 0 && hasValue)
+        opts.frames = std::atoi(argv[++i]);
+      else if (std::strcmp(argv[i], "--capture") == 0 && hasValue)
+        opts.captureDir = argv[++i];
+      else if (std::strcmp(argv[i], "--capture-every") == 0 && hasValue)
+        opts.captureEvery = std::max(1, std::atoi(argv[++i]));
+      else if (std::strcmp(argv[i], "--benchmark") == 0 && hasValue)
+        opts.benchmarkCsv = argv[++i];
+      else if (std::strcmp(argv[i], "--trace") == 0 && hasValue)
+        opts.traceJson = argv[++i];
+      else
+        std::cout << "Ignoring unknown argument " << argv[i] << std::endl;
+    }
+    return opts;
+  }
+
+  bool shouldCapture(int frame) const {
+    return !captureDir.empty() && frame % captureEvery == 0;
+  }
+};
+
+// glfwInit. Headless runs ask for GLFW's display-less null platform (GLFW
+// 3.4+) and fall back to the default one, where the window is just hidden.
+inline bool initGlfw(bool headless) {
+#ifdef GLFW_PLATFORM_NULL
+  if (headless) {
+    glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+    if (glfwInit())
+      return true;
+    glfwInitHint(GLFW_PLATFORM, GLFW_ANY_PLATFORM);
+  }
+#endif
+  return glfwInit();
+}
+
+// glfwCreateWindow with the context hints already set. Headless windows are
+// invisible and get an EGL context (surfaceless on the null platform, which
+// is what Mesa's llvmpipe offers without a display), then OSMesa if EGL is
+// unavailable.
+inline GLFWwindow *createWindow(int width, int height, const char *title,
+                                bool headless) {
+  if (!headless)
+    return glfwCreateWindow(width, height, title, NULL, NULL);
+  glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+  glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+  GLFWwindow *window = glfwCreateWindow(width, height, title, NULL, NULL);
+  if (!window) {
+    glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+    window = glfwCreateWindow(width, height, title, NULL, NULL);
+  }
+  return window;
+}
+
+// Colour and depth renderbuffers the frame is drawn into when there is no
+// default framebuffer to look at; frames are read back from here.
+class OffscreenTarget {
+public:
+  unsigned int FBO, colorRBO, depthRBO;
+  int width, height;
+
+  OffscreenTarget(int width, int height) : width(width), height(height) {
+    glGenFramebuffers(1, &FBO);
+    glGenRenderbuffers(1, &colorRBO);
+    glGenRenderbuffers(1, &depthRBO);
+    glBindRenderbuffer(GL_RENDERBUFFER, colorRBO);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, depthRBO);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width,
+                          height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                              GL_RENDERBUFFER, colorRBO);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                              GL_RENDERBUFFER, depthRBO);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+      std::cout << "Offscreen framebuffer is incomplete" << std::endl;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  }
+
+  void bind() const {
+    glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+    glViewport(0, 0, width, height);
+  }
+
+  // Binary PPM, top row first
+  bool savePPM(const std::string &path) const {
+    std::vector<unsigned char> pixels((size_t)width * height * 3);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, FBO);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE,
+                 pixels.data());
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+    FILE *file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+      std::cout << "Could not write frame to " << path << std::endl;
+      return false;
+    }
+    std::fprintf(file, "P6\n%d %d\n255\n", width, height);
+    for (int y = height - 1; y >= 0; y--)
+      std::fwrite(&pixels[(size_t)y * width * 3], 1, (size_t)width * 3, file);
+    return std::fclose(file) == 0;
+  }
+
+  // DIR/frame_NNNN.ppm
+  bool saveFrame(const std::string &dir, int frame) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "/frame_%04d.ppm", frame);
+    return savePPM(dir + name);
+  }
+};
+
+#endif
@@ -0,0 +1,155 @@
+#ifndef LIGHT_BUFFER_H
+#define LIGHT_BUFFER_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "frustum.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+// Must match MAX_POINT_LIGHTS and the LightBlock declaration in fshader.glsl.
+// At most 31, so a draw's lights fit in the bits of drawLightMask.
+const int MAX_POINT_LIGHTS = 16;
+const unsigned int LIGHT_BLOCK_BINDING = 0;
+
+// One point light in std140 layout. Every vec3 is padded to 16 bytes, so the
+// scalar attenuation terms and the range ride in the fourth component of each
+// row. The same 64 bytes are four RGBA32F texels of the clustered light
+// buffer (see LightClusters).
+struct PointLightStd140 {
+  glm::vec3 position;
+  float constant;
+  glm::vec3 ambient;
+  float linear;
+  glm::vec3 diffuse;
+  float quadratic;
+  glm::vec3 specular;
+  float range; // distance beyond which the light is ignored, see lightRange
+};
+static_assert(sizeof(PointLightStd140) == 64, "std140 PointLight is 64 bytes");
+
+// Light contributions below this, per colour channel, are dropped: at worst
+// a step of 4/255 in 8-bit output, where otherwise every torch in a long tomb
+// would reach every fragment.
+const float LIGHT_CUTOFF = 1.0f / 64.0f;
+
+// Distance at which the light's brightest channel, attenuated by
+// 1 / (constant + linear d + quadratic d^2), falls to LIGHT_CUTOFF. Specular
+// is counted at its peak. A light that is off has range 0.
+inline float lightRange(const PointLightStd140 &light) {
+  glm::vec3 peak = light.ambient + light.diffuse + light.specular;
+  float brightest = std::max(peak.x, std::max(peak.y, peak.z));
+  if (brightest <= 0.0f)
+    return 0.0f;
+  // solve quadratic d^2 + linear d + constant = brightest / LIGHT_CUTOFF
+  float a = light.quadratic, b = light.linear,
+        c = light.constant - brightest / LIGHT_CUTOFF;
+  if (c >= 0.0f)
+    return 0.0f; // never brighter than the cut-off
+  if (a <= 0.0f)
+    return b > 0.0f ? -c / b : 1e30f;
+  return (-b + std::sqrt(b * b - 4.0f * a * c)) / (2.0f * a);
+}
+
+// Box around the sphere the light reaches
+inline AABB lightBounds(const PointLightStd140 &light) {
+  glm::vec3 r(light.range);
+  return {light.position - r, light.position + r};
+}
+
+// whether the light's sphere touches box
+inline bool lightReaches(const PointLightStd140 &light, const AABB &box) {
+  glm::vec3 nearest = glm::clamp(light.position, box.min, box.max);
+  glm::vec3 d = nearest - light.position;
+  return glm::dot(d, d) <= light.range * light.range;
+}
+
+struct LightBlockStd140 {
+  int numPointLights;
+  int pad[3];
+  PointLightStd140 pointLights[MAX_POINT_LIGHTS];
+};
+
+// CPU-side copy of the LightBlock uniform buffer. Lights are compared against
+// what was last written and only the changed span is sent, in a single
+// glBufferSubData, so a frame where nothing flickers or toggles uploads
+// nothing.
+class LightBuffer {
+public:
+  unsigned int UBO;
+
+  LightBuffer() {
+    data = LightBlockStd140();
+    glGenBuffers(1, &UBO);
+    glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(data), &data, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, LIGHT_BLOCK_BINDING, UBO);
+    clearDirty();
+  }
+
+  // point the program's LightBlock at our binding point (GLSL 330 has no
+  // layout(binding = N), so this is done once per program after link)
+  void attach(unsigned int program) {
+    unsigned int index = glGetUniformBlockIndex(program, "LightBlock");
+    if (index != GL_INVALID_INDEX)
+      glUniformBlockBinding(program, index, LIGHT_BLOCK_BINDING);
+  }
+
+  void setCount(int count) {
+    if (data.numPointLights == count)
+      return;
+    data.numPointLights = count;
+    markDirty(offsetof(LightBlockStd140, numPointLights), sizeof(int));
+  }
+
+  void setPointLight(int i, const PointLightStd140 &light) {
+    if (std::memcmp(&data.pointLights[i], &light, sizeof(light)) == 0)
+      return;
+    data.pointLights[i] = light;
+    markDirty(offsetof(LightBlockStd140, pointLights) + i * sizeof(light),
+              sizeof(light));
+  }
+
+  // Bit i set for each light in the block whose range reaches box, for the
+  // shader's drawLightMask: a draw evaluates only the lights that touch it
+  int reachMask(const AABB &box) const {
+    int mask = 0;
+    for (int i = 0; i < data.numPointLights; i++)
+      if (lightReaches(data.pointLights[i], box))
+        mask |= 1 << i;
+    return mask;
+  }
+
+  // send the changed span, if any
+  void upload() {
+    if (dirtyBegin >= dirtyEnd)
+      return;
+    glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+    glBufferSubData(GL_UNIFORM_BUFFER, dirtyBegin, dirtyEnd - dirtyBegin,
+                    reinterpret_cast<const char *>(&data) + dirtyBegin);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    clearDirty();
+  }
+
+private:
+  LightBlockStd140 data;
+  size_t dirtyBegin, dirtyEnd;
+
+  void markDirty(size_t offset, size_t size) {
+    if (offset < dirtyBegin)
+      dirtyBegin = offset;
+    if (offset + size > dirtyEnd)
+      dirtyEnd = offset + size;
+  }
+  void clearDirty() {
+    dirtyBegin = sizeof(data);
+    dirtyEnd = 0;
+  }
+};
+
+#endif
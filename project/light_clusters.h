@@ -0,0 +1,314 @@
+#ifndef LIGHT_CLUSTERS_H
+#define LIGHT_CLUSTERS_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "light_buffer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Must match CLUSTER_X/Y/Z in fshader.glsl
+const int CLUSTER_X = 16, CLUSTER_Y = 12, CLUSTER_Z = 24;
+const int CLUSTER_COUNT = CLUSTER_X * CLUSTER_Y * CLUSTER_Z;
+
+// Point lights binned into a froxel grid for clustered forward shading. The
+// view frustum is cut into CLUSTER_X x CLUSTER_Y screen tiles and CLUSTER_Z
+// depth slices, spaced exponentially between the near and far planes so
+// every cluster is roughly cube-shaped. A fragment finds its cluster from
+// gl_FragCoord and its view depth and loops over that cluster's lights
+// only, so shading cost follows how many lights overlap a pixel rather than
+// how many there are.
+//
+// Two texture buffers hold the result:
+//   lights  (RGBA32F) four texels per light, laid out as PointLightStd140
+//   clusters (R32UI)  CLUSTER_COUNT (offset, count) pairs, then the light
+//                     indices they point into
+//
+// Binning runs in three steps. Each light's sphere (of radius lightRange) is
+// reduced to a box of cluster coordinates, in flat per-component arrays so
+// the loop vectorises. The depth slices are then split into blocks, one per
+// thread; a block counts its clusters' lights, prefix-sums them and fills
+// its own index list, touching nothing another block owns. Last, the block
+// lists are joined. Lights keep their submission order in every cluster.
+class LightClusters {
+public:
+  // lights and index references in the last build, for the title bar
+  int lightCount = 0, referenceCount = 0;
+
+  LightClusters() {
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+    glGenBuffers(2, buffers);
+    glGenTextures(2, textures);
+    glBindBuffer(GL_TEXTURE_BUFFER, buffers[0]);
+    glBufferData(GL_TEXTURE_BUFFER, sizeof(PointLightStd140), nullptr,
+                 GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, buffers[1]);
+    glBufferData(GL_TEXTURE_BUFFER, CLUSTER_COUNT * 2 * sizeof(uint32_t),
+                 nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    glBindTexture(GL_TEXTURE_BUFFER, textures[0]);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffers[0]);
+    glBindTexture(GL_TEXTURE_BUFFER, textures[1]);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, buffers[1]);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    table.assign(CLUSTER_COUNT * 2, 0);
+
+    int threads = std::max(
+        1, std::min((int)std::thread::hardware_concurrency(), MAX_THREADS));
+    blocks.resize(threads);
+    for (int b = 0; b < threads; b++) {
+      blocks[b].firstSlice = b * CLUSTER_Z / threads;
+      blocks[b].endSlice = (b + 1) * CLUSTER_Z / threads;
+    }
+    // the calling thread bins block 0 itself
+    for (int b = 1; b < threads; b++)
+      workers.emplace_back(&LightClusters::worker, this, b);
+  }
+
+  ~LightClusters() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      quit = true;
+    }
+    wake.notify_all();
+    for (std::thread &w : workers)
+      w.join();
+    glDeleteTextures(2, textures);
+    glDeleteBuffers(2, buffers);
+  }
+
+  LightClusters(const LightClusters &) = delete;
+  LightClusters &operator=(const LightClusters &) = delete;
+
+  void clear() { lights.clear(); }
+  // light.range must be set (see lightRange)
+  void add(const PointLightStd140 &light) { lights.push_back(light); }
+
+  // Bin the lights for a camera with a symmetric perspective projection
+  // (glm::perspective) between zNear and zFar
+  void build(const glm::mat4 &view, const glm::mat4 &projection, float zNear,
+             float zFar) {
+    lightCount = (int)lights.size();
+    setDepthRange(zNear, zFar);
+    computeBounds(view, projection, zNear, zFar);
+    if (lightCount >= PARALLEL_MIN_LIGHTS && !workers.empty())
+      runBlocksInParallel();
+    else
+      for (size_t b = 0; b < blocks.size(); b++)
+        binBlock((int)b);
+    joinBlocks();
+  }
+
+  // Replace both buffers' contents (orphaning the old storage)
+  void upload() {
+    glBindBuffer(GL_TEXTURE_BUFFER, buffers[0]);
+    glBufferData(GL_TEXTURE_BUFFER,
+                 std::max<size_t>(1, lights.size()) * sizeof(PointLightStd140),
+                 nullptr, GL_STREAM_DRAW);
+    if (!lights.empty())
+      glBufferSubData(GL_TEXTURE_BUFFER, 0,
+                      lights.size() * sizeof(PointLightStd140), lights.data());
+    glBindBuffer(GL_TEXTURE_BUFFER, buffers[1]);
+    glBufferData(GL_TEXTURE_BUFFER, clusterData.size() * sizeof(uint32_t),
+                 clusterData.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+  }
+
+  // lights on lightUnit, the cluster table on lightUnit + 1
+  void bind(unsigned int lightUnit) const {
+    glActiveTexture(GL_TEXTURE0 + lightUnit);
+    glBindTexture(GL_TEXTURE_BUFFER, textures[0]);
+    glActiveTexture(GL_TEXTURE0 + lightUnit + 1);
+    glBindTexture(GL_TEXTURE_BUFFER, textures[1]);
+    glActiveTexture(GL_TEXTURE0);
+  }
+
+  // slice = log(depth) * x + y, for the fragment shader
+  glm::vec2 depthSlicing() const { return glm::vec2(sliceScale, sliceBias); }
+
+private:
+  static const int MAX_THREADS = 4;
+  // below this, waking the workers costs more than the binning
+  static const int PARALLEL_MIN_LIGHTS = 64;
+
+  // A run of depth slices binned by one thread into its own index list
+  struct Block {
+    int firstSlice, endSlice;
+    std::vector<uint32_t> indices;
+  };
+
+  std::vector<PointLightStd140> lights;
+  // each light's cluster box, inclusive; x0 > x1 when it touches none
+  std::vector<int> x0, x1, y0, y1, z0, z1;
+  std::vector<Block> blocks;
+  // (offset, count) per cluster, offsets relative to the owning block
+  std::vector<uint32_t> table;
+  std::vector<uint32_t> clusterData; // what upload() sends
+  float sliceScale = 1.0f, sliceBias = 0.0f;
+  int maxTexels = 65536;
+
+  unsigned int buffers[2], textures[2];
+
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable wake, finished;
+  int generation = 0, busy = 0;
+  bool quit = false;
+
+  void setDepthRange(float zNear, float zFar) {
+    sliceScale = CLUSTER_Z / std::log(zFar / zNear);
+    sliceBias = -std::log(zNear) * sliceScale;
+  }
+
+  int sliceOf(float depth) const {
+    int s = (int)std::floor(std::log(depth) * sliceScale + sliceBias);
+    return std::min(std::max(s, 0), CLUSTER_Z - 1);
+  }
+
+  static int tileOf(float ndc, int tiles) {
+    int t = (int)std::floor((ndc * 0.5f + 0.5f) * tiles);
+    return std::min(std::max(t, 0), tiles - 1);
+  }
+
+  // Screen and depth range of every light's bounding box in view space. Its
+  // projected x extent lies between the projections of its near and far
+  // faces' edges, so the min/max of four divisions bounds it; a box that
+  // reaches the near plane covers the whole screen.
+  void computeBounds(const glm::mat4 &view, const glm::mat4 &projection,
+                     float zNear, float zFar) {
+    int n = lightCount;
+    x0.resize(n);
+    x1.resize(n);
+    y0.resize(n);
+    y1.resize(n);
+    z0.resize(n);
+    z1.resize(n);
+    float px = projection[0][0], py = projection[1][1];
+    for (int i = 0; i < n; i++) {
+      glm::vec3 c = glm::vec3(view * glm::vec4(lights[i].position, 1.0f));
+      float r = lights[i].range;
+      float nearDepth = -c.z - r, farDepth = -c.z + r;
+      if (r <= 0.0f || farDepth < zNear || nearDepth > zFar) {
+        x0[i] = 1;
+        x1[i] = 0;
+        continue;
+      }
+      float ndc[4] = {-1.0f, 1.0f, -1.0f, 1.0f}; // x min/max, y min/max
+      if (nearDepth > zNear) {
+        float invNear = 1.0f / nearDepth, invFar = 1.0f / farDepth;
+        float lo[2] = {c.x - r, c.y - r}, hi[2] = {c.x + r, c.y + r};
+        float scale[2] = {px, py};
+        for (int a = 0; a < 2; a++) {
+          float l0 = lo[a] * invNear, l1 = lo[a] * invFar;
+          float h0 = hi[a] * invNear, h1 = hi[a] * invFar;
+          ndc[a * 2] = scale[a] * std::min(l0, l1);
+          ndc[a * 2 + 1] = scale[a] * std::max(h0, h1);
+        }
+      }
+      x0[i] = tileOf(ndc[0], CLUSTER_X);
+      x1[i] = tileOf(ndc[1], CLUSTER_X);
+      y0[i] = tileOf(ndc[2], CLUSTER_Y);
+      y1[i] = tileOf(ndc[3], CLUSTER_Y);
+      z0[i] = sliceOf(std::max(nearDepth, zNear));
+      z1[i] = sliceOf(std::min(farDepth, zFar));
+    }
+  }
+
+  // Count, prefix-sum and fill the clusters of block b's slices
+  void binBlock(int b) {
+    Block &block = blocks[b];
+    const int perSlice = CLUSTER_X * CLUSTER_Y;
+    int first = block.firstSlice * perSlice, end = block.endSlice * perSlice;
+    uint32_t *entry = &table[0];
+    for (int c = first; c < end; c++)
+      entry[c * 2 + 1] = 0;
+
+    auto forEachCluster = [&](auto &&visit) {
+      for (int i = 0; i < lightCount; i++) {
+        if (x0[i] > x1[i])
+          continue;
+        int s0 = std::max(z0[i], block.firstSlice);
+        int s1 = std::min(z1[i], block.endSlice - 1);
+        for (int s = s0; s <= s1; s++)
+          for (int y = y0[i]; y <= y1[i]; y++) {
+            int row = (s * CLUSTER_Y + y) * CLUSTER_X;
+            for (int x = x0[i]; x <= x1[i]; x++)
+              visit(row + x, i);
+          }
+      }
+    };
+
+    forEachCluster([&](int c, int) { entry[c * 2 + 1]++; });
+    uint32_t total = 0;
+    for (int c = first; c < end; c++) {
+      entry[c * 2] = total;
+      total += entry[c * 2 + 1];
+      entry[c * 2 + 1] = 0; // refilled as the insertion cursor
+    }
+    block.indices.resize(total);
+    forEachCluster([&](int c, int i) {
+      block.indices[entry[c * 2] + entry[c * 2 + 1]++] = (uint32_t)i;
+    });
+  }
+
+  // Block lists back to back after the table, with the offsets made
+  // absolute. Past GL_MAX_TEXTURE_BUFFER_SIZE clusters lose their last
+  // lights rather than the frame failing.
+  void joinBlocks() {
+    clusterData.assign(table.begin(), table.end());
+    const int perSlice = CLUSTER_X * CLUSTER_Y;
+    size_t capacity = (size_t)std::max(maxTexels, CLUSTER_COUNT * 2);
+    for (const Block &block : blocks) {
+      for (int c = block.firstSlice * perSlice; c < block.endSlice * perSlice;
+           c++) {
+        uint32_t count = table[c * 2 + 1];
+        count = (uint32_t)std::min<size_t>(count,
+                                           capacity - clusterData.size());
+        clusterData[c * 2] = (uint32_t)clusterData.size();
+        clusterData[c * 2 + 1] = count;
+        const uint32_t *src = block.indices.data() + table[c * 2];
+        clusterData.insert(clusterData.end(), src, src + count);
+      }
+    }
+    referenceCount = (int)clusterData.size() - CLUSTER_COUNT * 2;
+  }
+
+  void runBlocksInParallel() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      busy = (int)workers.size();
+      generation++;
+    }
+    wake.notify_all();
+    binBlock(0);
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [this] { return busy == 0; });
+  }
+
+  void worker(int b) {
+    int seen = 0;
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [&] { return quit || generation != seen; });
+        if (quit)
+          return;
+        seen = generation;
+      }
+      binBlock(b);
+      std::lock_guard<std::mutex> lock(mutex);
+      if (--busy == 0)
+        finished.notify_one();
+    }
+  }
+};
+
+#endif
@@ -2,14 +2,30 @@
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
+#include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <iostream>
+#include <memory>
+#include <string>
 #include <vector>
 
 #include "audio.h"
+#include "benchmark.h"
 #include "camera.h"
+#include "gbuffer.h"
 #include "geometry.h"
+#include "headless.h"
+#include "light_buffer.h"
+#include "light_clusters.h"
+#include "model_file.h"
+#include "portal.h"
+#include "profiler.h"
+#include "render_queue.h"
+#include "render_state.h"
+#include "scene.h"
 #include "shader.h"
+#include "texture_array.h"
 
 // STB Image implementation
 #define STB_IMAGE_IMPLEMENTATION
@@ -22,6 +38,12 @@
 // Settings
 const unsigned int SCR_WIDTH = 1000;
 const unsigned int SCR_HEIGHT = 800;
+const float NEAR_PLANE = 0.1f;
+const float FAR_PLANE = 100.0f;
+// Size of what is rendered to (the window's framebuffer, or the offscreen
+// target), for finding a fragment's light cluster
+int framebufferWidth = SCR_WIDTH;
+int framebufferHeight = SCR_HEIGHT;
 
 // Camera
 Camera camera(glm::vec3(0.0f, 1.5f, 10.0f));
@@ -46,6 +68,55 @@ bool sarcophagusInteract = false;
 bool flashlightOn = true;
 bool lanternsOn = true;
 
+// Render path for the baked static scene, cycled with I for comparison:
+// one draw per piece, one instanced draw per material, or one pre-transformed
+// merged mesh per material and colour
+enum StaticRenderPath { STATIC_IMMEDIATE, STATIC_INSTANCED, STATIC_MERGED };
+const char *staticPathNames[] = {"immediate", "instanced", "merged"};
+StaticRenderPath staticPath = STATIC_INSTANCED;
+
+// How lantern lights reach the shader, cycled with C: every light in the
+// LightBlock uniform buffer (at most MAX_POINT_LIGHTS, all evaluated per
+// fragment), binned into view-space clusters so a fragment evaluates only
+// the lights that reach it, or deferred: the opaque scene is written to a
+// G-buffer and every pixel is lit once, from the same clusters
+enum LightingPath {
+  LIGHTING_UNIFORM_BLOCK,
+  LIGHTING_CLUSTERED,
+  LIGHTING_DEFERRED
+};
+const char *lightingPathNames[] = {"uniform block", "clustered", "deferred"};
+const int LIGHTING_PATH_COUNT = 3;
+LightingPath lightingPath = LIGHTING_CLUSTERED;
+
+// Texture unit of the clustered light buffer; the cluster table is on the
+// next one
+const unsigned int CLUSTER_TEXTURE_UNIT = 2;
+// First of the three G-buffer texture units (albedo, normal, depth)
+const unsigned int GBUFFER_TEXTURE_UNIT = 4;
+
+// Feed the cube as 24-byte packed vertices (10:10:10:2 normals and tangents,
+// half-float UVs) instead of 44-byte float vertices
+const bool PACKED_VERTICES = true;
+
+// Decode textures on worker threads and stream them in after the first
+// frame, showing a grey placeholder until then
+const bool ASYNC_TEXTURES = true;
+
+// Mip chains of the tomb textures, written on first run and memory-mapped
+// after that. BC1 compression cuts VRAM to 4 bits per texel, but later runs
+// then render lossy textures the first run did not, so headless captures and
+// benchmarks would depend on whether the cache exists; off by default.
+const char *TEXTURE_CACHE_PATH = "resources/tomb_textures.texcache";
+const bool COMPRESS_TEXTURE_CACHE = false;
+
+// Skip static cells, lanterns and the lid when they are outside the view
+// frustum
+const bool FRUSTUM_CULLING = true;
+// ...narrowed through the corridor's doorways from the camera's cell, which
+// also leaves out lantern lights that cannot reach anything visible
+const bool PORTAL_CULLING = true;
+
 // Lighting
 glm::vec3 lightPos(0.0f, 2.0f, 0.0f); // Central light
 
@@ -54,12 +125,13 @@ void framebuffer_size_callback(GLFWwindow *window, int width, int height);
 void mouse_callback(GLFWwindow *window, double xpos, double ypos);
 void scroll_callback(GLFWwindow *window, double xoffset, double yoffset);
 void processInput(GLFWwindow *window);
-unsigned int loadTexture(const char *path);
+void interactWithSarcophagus();
 
-void drawSarcophagus(Shader &shader, Cube &cube, glm::mat4 parentModel,
-                     float slideAmount, unsigned int textureID);
-void drawLantern(Shader &shader, Cube &cube, Cylinder &cyl, glm::mat4 model,
-                 float time, unsigned int textureID);
+// Number of 5-unit corridor segments (dividers, beams, panels, ceiling)
+const int CORRIDOR_SEGMENTS = 10;
+
+// Sarcophagus placement; its parts are in SARCOPHAGUS_MODEL_PATH
+const glm::vec3 SARCOPHAGUS_POS(0.0f, -0.5f, -20.0f);
 
 // Lantern positions: 4 per side, alternating along Z
 struct LanternInfo {
@@ -78,9 +150,120 @@ const LanternInfo lanterns[] = {
 };
 const int NUM_LANTERNS = 8;
 
-int main() {
+// Part hierarchies of the props (see model_file.h for the format)
+const char *LANTERN_MODEL_PATH = "resources/lantern.model";
+const char *SARCOPHAGUS_MODEL_PATH = "resources/sarcophagus.model";
+
+// A loaded model with its mesh and material names resolved for the render
+// queue, and the current value of each animation channel. Every placement
+// of the prop shares these values.
+struct Prop {
+  Model model;
+  std::vector<DrawMesh> meshes; // per model mesh name
+  std::vector<int> materials;   // Material per model material name
+  std::vector<float> channels;
+  std::vector<float> posed; // channel values the placements were posed with
+};
+
+// One placement of a prop, with the world matrix of every part. Parts are
+// only recomputed when a channel they depend on changes.
+struct PropInstance {
+  glm::mat4 root;
+  std::vector<glm::mat4> world;
+};
+
+Prop lanternProp, sarcophagusProp;
+PropInstance lanternInstances[NUM_LANTERNS], sarcophagusInstance;
+// The lantern part culled against, with a sphere holding the handle, cup
+// and flames around it
+int lanternCenterPart = -1;
+const float LANTERN_BOUNDING_RADIUS = 0.75f;
+
+bool loadProp(Prop &prop, const char *path);
+void placeProp(const Prop &prop, PropInstance &instance,
+               const glm::mat4 &root);
+void setChannel(Prop &prop, int channel, float value);
+uint32_t changedChannels(Prop &prop);
+void bakeProp(StaticScene &scene, const Prop &prop,
+              const PropInstance &instance);
+void buildStaticScene(StaticScene &scene);
+void buildCellGraph(CellGraph &graph);
+struct SceneUniforms;
+void drawStaticScene(Shader &shader, const SceneUniforms &u,
+                     const LightBuffer &lights, Cube &cube,
+                     StaticScene &scene, RenderQueue &queue);
+void submitProp(RenderQueue &queue, const Cylinder &cyl, const Prop &prop,
+                const PropInstance &instance, const CellGraph *visibility,
+                const glm::mat4 &view, float projScale);
+void drawQueue(Shader &shader, const SceneUniforms &u,
+               const LightBuffer &lights, Cube &cube, Cylinder &cyl,
+               const RenderQueue &queue, const std::vector<uint32_t> &order,
+               size_t first, size_t last);
+
+// Cylinder triangles submitted since the stats were last shown
+unsigned long cylinderTriangles = 0;
+// Static pieces and lanterns left after culling, since the stats were last
+// shown
+unsigned long staticPiecesDrawn = 0, lanternsDrawn = 0;
+// Visible cells and lantern lights uploaded, lights whose reach misses
+// everything visible, and light references in the cluster lists, since the
+// stats were last shown
+unsigned long cellsVisible = 0, lightsUsed = 0, lightsCulled = 0,
+              clusterReferences = 0;
+// Draws given a light mask, and the lights in those masks
+unsigned long litDraws = 0, drawLightRefs = 0;
+
+// Blend/depth state and the bound program; redundant changes never reach GL
+RenderState renderState;
+
+// Uniform handles, resolved once after the main shader links so the render
+// loop and draw helpers never pass uniform names (or build them per light).
+struct SpotLightUniforms {
+  Uniform position, direction, ambient, diffuse, specular;
+  Uniform constant, linear, quadratic, cutOff, outerCutOff;
+};
+
+struct SceneUniforms {
+  Uniform model, view, projection, viewPos, inverseViewProjection;
+  Uniform objectColor, useTexture, useNormalMap, uvScale, textureLayer;
+  Uniform useEmissive, emissiveColor, useInstancing;
+  Uniform spotLightOn;
+  Uniform useClusters, numClusteredLights, clusterScale, clusterDepth;
+  Uniform drawLightMask;
+  SpotLightUniforms spotLight;
+};
+// ...for the forward shader, the deferred geometry pass and the deferred
+// lighting pass; each program has its own locations
+SceneUniforms uniforms, gbufferUniforms, deferredUniforms;
+
+SceneUniforms cacheSceneUniforms(const Shader &shader);
+void setLighting(Shader &shader, const SceneUniforms &u, bool clustered,
+                 const LightClusters &clusters, int width, int height);
+void setDrawLights(Shader &shader, const SceneUniforms &u,
+                   const LightBuffer &lights, const AABB &bounds);
+
+// Scripted benchmark: simulated time advances a fixed step per frame, the
+// camera follows buildBenchmarkPath() and the lid is opened on cue
+const float BENCHMARK_TIMESTEP = 1.0f / 60.0f;
+const float BENCHMARK_OPEN_LID_TIME = 20.0f;
+CameraPath buildBenchmarkPath();
+
+int main(int argc, char **argv) {
+  HeadlessOptions headless = HeadlessOptions::parse(argc, argv);
+  bool benchmark = !headless.benchmarkCsv.empty();
+  auto startTime = std::chrono::steady_clock::now();
+  auto msSinceStart = [&startTime]() {
+    return std::chrono::duration<double, std::milli>(
+               std::chrono::steady_clock::now() - startTime)
+        .count();
+  };
+  bool firstFrame = true;
+
   // glfw: initialize and configure
-  glfwInit();
+  if (!initGlfw(headless.enabled)) {
+    std::cout << "Failed to initialize GLFW" << std::endl;
+    return -1;
+  }
   glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
   glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
   glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
@@ -90,8 +273,8 @@ int main() {
 #endif
 
   // glfw window creation
-  GLFWwindow *window =
-      glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "The Crypt of Thoth", NULL, NULL);
+  GLFWwindow *window = createWindow(SCR_WIDTH, SCR_HEIGHT,
+                                    "The Crypt of Thoth", headless.enabled);
   if (window == NULL) {
     std::cout << "Failed to create GLFW window" << std::endl;
     glfwTerminate();
@@ -101,9 +284,12 @@ int main() {
   glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
   glfwSetCursorPosCallback(window, mouse_callback);
   glfwSetScrollCallback(window, scroll_callback);
+  if (!headless.enabled)
+    glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
 
   // tell GLFW to capture our mouse
-  glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+  if (!headless.enabled)
+    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
   // glew init
   if (glewInit() != GLEW_OK) {
@@ -112,40 +298,162 @@ int main() {
   }
 
   // configure global opengl state
-  glEnable(GL_DEPTH_TEST);
+  renderState.enable(GL_DEPTH_TEST, true);
 
   // Start background music
-  startBackgroundMusic("resources/arabian_nights.mp3");
+  if (!headless.enabled)
+    startBackgroundMusic("resources/arabian_nights.mp3");
+
+  // Headless frames go to an FBO, as there may be no default framebuffer
+  std::unique_ptr<OffscreenTarget> offscreen;
+  if (headless.enabled)
+    offscreen.reset(new OffscreenTarget(SCR_WIDTH, SCR_HEIGHT));
+  int frameIndex = 0;
+
+  CameraPath benchmarkPath = buildBenchmarkPath();
+  FrameStats frameStats;
+  bool benchmarkLidOpened = false;
 
   // build and compile shaders
   Shader mainShader("vshader.glsl", "fshader.glsl");
+  // deferred path: the scene's vertex shader writing the G-buffer, and a
+  // full-screen lighting pass
+  Shader gbufferShader("vshader.glsl", "gbuffer_fshader.glsl");
+  Shader deferredShader("deferred_vshader.glsl", "deferred_fshader.glsl");
 
   // Geometry
-  Cube cube;
+  Cube cube(PACKED_VERTICES);
   Cylinder cylinder(36);
 
-  // Load textures
-  unsigned int wallTexture = loadTexture("resources/wall_texture.png");
-  unsigned int floorTexture = loadTexture("resources/floor_texture.png");
-  unsigned int pillarTexture = loadTexture("resources/pillar_texture.png");
-  unsigned int lanternTexture = loadTexture("resources/lantern_texture.png");
-  unsigned int graveyardTexture =
-      loadTexture("resources/graveyard_texture.png");
+  // Load textures: every tomb material is one layer of a texture array,
+  // indexed by Material
+  std::vector<std::string> materialPaths(MATERIAL_COUNT);
+  materialPaths[MATERIAL_FLOOR] = "resources/floor_texture.png";
+  materialPaths[MATERIAL_PILLAR] = "resources/pillar_texture.png";
+  materialPaths[MATERIAL_WALL] = "resources/wall_texture.png";
+  materialPaths[MATERIAL_LANTERN] = "resources/lantern_texture.png";
+  materialPaths[MATERIAL_GRAVEYARD] = "resources/graveyard_texture.png";
+  // benchmarks wait for every texture so no run measures the placeholder
+  TextureArray materialTextures(materialPaths, ASYNC_TEXTURES && !benchmark,
+                                TEXTURE_CACHE_PATH, COMPRESS_TEXTURE_CACHE);
+
+  // Props, placed once; parts marked static are baked below, the rest are
+  // posed from their channels each frame
+  if (!loadProp(lanternProp, LANTERN_MODEL_PATH) ||
+      !loadProp(sarcophagusProp, SARCOPHAGUS_MODEL_PATH)) {
+    glfwTerminate();
+    return -1;
+  }
+  lanternCenterPart = lanternProp.model.find("cup_frame");
+  if (lanternCenterPart < 0) {
+    std::cout << LANTERN_MODEL_PATH << ": no cup_frame part" << std::endl;
+    glfwTerminate();
+    return -1;
+  }
+  for (int i = 0; i < NUM_LANTERNS; i++) {
+    glm::mat4 root = glm::translate(glm::mat4(1.0f), lanterns[i].position);
+    // lanterns on the right wall are mirrored to face the corridor
+    root = glm::scale(root, glm::vec3(lanterns[i].facingX, 1.0f, 1.0f));
+    placeProp(lanternProp, lanternInstances[i], root);
+  }
+  placeProp(sarcophagusProp, sarcophagusInstance,
+            glm::translate(glm::mat4(1.0f), SARCOPHAGUS_POS));
+  const Model &lanternModel = lanternProp.model;
+  int lanternLit = lanternModel.channel("lit");
+  int flameFlicker[3] = {lanternModel.channel("flicker1"),
+                         lanternModel.channel("flicker2"),
+                         lanternModel.channel("flicker3")};
+  int flameSwayX = lanternModel.channel("sway_x");
+  int flameSwayZ = lanternModel.channel("sway_z");
+  int lidSlide = sarcophagusProp.model.channel("slide");
+
+  // Bake everything that never moves; per frame only the lid, the flames
+  // and the camera are computed
+  StaticScene staticScene(cube);
+  buildStaticScene(staticScene);
+
+  // Corridor cells and doorways; left empty, visibility is the plain
+  // frustum
+  CellGraph cellGraph;
+  if (PORTAL_CULLING)
+    buildCellGraph(cellGraph);
 
   // Shader config
-  mainShader.use();
-  mainShader.setInt("texture1", 0);
+  renderState.useProgram(mainShader.ID);
+  mainShader.setInt("textureLayers", 0);
   mainShader.setInt("normalMap", 1);
+  mainShader.setInt("clusterLights", CLUSTER_TEXTURE_UNIT);
+  mainShader.setInt("clusterData", CLUSTER_TEXTURE_UNIT + 1);
   mainShader.setBool("useEmissive", false);
   mainShader.setVec2("uvScale", glm::vec2(1.0f, 1.0f));
+  uniforms = cacheSceneUniforms(mainShader);
+  renderState.useProgram(gbufferShader.ID);
+  gbufferShader.setInt("textureLayers", 0);
+  gbufferShader.setInt("normalMap", 1);
+  gbufferShader.setVec2("uvScale", glm::vec2(1.0f, 1.0f));
+  gbufferUniforms = cacheSceneUniforms(gbufferShader);
+  renderState.useProgram(deferredShader.ID);
+  deferredShader.setInt("gAlbedo", GBUFFER_TEXTURE_UNIT);
+  deferredShader.setInt("gNormal", GBUFFER_TEXTURE_UNIT + 1);
+  deferredShader.setInt("gDepth", GBUFFER_TEXTURE_UNIT + 2);
+  deferredShader.setInt("clusterLights", CLUSTER_TEXTURE_UNIT);
+  deferredShader.setInt("clusterData", CLUSTER_TEXTURE_UNIT + 1);
+  deferredUniforms = cacheSceneUniforms(deferredShader);
+
+  // Lantern lights live in a uniform buffer that only changes when a light
+  // flickers or is toggled
+  LightBuffer lightBuffer;
+  lightBuffer.attach(mainShader.ID);
+  // ...or, on the clustered path, in texture buffers rebuilt every frame
+  LightClusters lightClusters;
+  lightClusters.bind(CLUSTER_TEXTURE_UNIT);
+
+  // Allocated at the framebuffer's size on first use
+  GBuffer gBuffer;
+
+  // Everything drawn per frame besides the baked static scene goes through
+  // here, sorted by material and depth
+  RenderQueue renderQueue;
+
+  // Per-section CPU/GPU times for the title bar, and --trace output
+  Profiler profiler(!headless.traceJson.empty());
+
+  // Uniform lookup and GL call counters, shown in the title bar once a
+  // second
+  float statsTimer = 0.0f;
+  unsigned int statsFrames = 0;
+  unsigned int glCallsIssued = 0, glCallsSkipped = 0;
+  Shader *shaders[] = {&mainShader, &gbufferShader, &deferredShader};
+  for (Shader *shader : shaders) {
+    shader->takeLookupsSaved();
+    shader->takeUniformWrites(glCallsIssued, glCallsSkipped);
+  }
+  renderState.takeCalls(glCallsIssued, glCallsSkipped);
+  glCallsIssued = glCallsSkipped = 0;
 
   // Render loop
   while (!glfwWindowShouldClose(window)) {
+    auto frameStart = std::chrono::steady_clock::now();
+    profiler.beginFrame();
     float currentFrame = glfwGetTime();
     deltaTime = currentFrame - lastFrame;
     lastFrame = currentFrame;
 
-    processInput(window);
+    profiler.begin("input", false);
+    if (benchmark) {
+      currentFrame = frameIndex * BENCHMARK_TIMESTEP;
+      deltaTime = BENCHMARK_TIMESTEP;
+      if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
+        glfwSetWindowShouldClose(window, true);
+      benchmarkPath.apply(camera, currentFrame);
+      if (!benchmarkLidOpened && currentFrame >= BENCHMARK_OPEN_LID_TIME) {
+        interactWithSarcophagus();
+        benchmarkLidOpened = true;
+      }
+    } else {
+      processInput(window);
+    }
+    profiler.end();
 
     // Logic
     bladeTime += deltaTime;
@@ -157,179 +465,282 @@ int main() {
     }
 
     glClearColor(0.05f, 0.05f, 0.05f, 1.0f);
+    if (offscreen)
+      offscreen->bind();
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    mainShader.use();
+    // The opaque scene goes either straight to the target, lit, or to the
+    // G-buffer; the additive flames are always drawn forward
+    bool deferred = lightingPath == LIGHTING_DEFERRED;
+    Shader &sceneShader = deferred ? gbufferShader : mainShader;
+    const SceneUniforms &sceneUniforms = deferred ? gbufferUniforms : uniforms;
+    int targetWidth = offscreen ? offscreen->width : framebufferWidth;
+    int targetHeight = offscreen ? offscreen->height : framebufferHeight;
 
     // View/Proj
     glm::mat4 projection =
         glm::perspective(glm::radians(camera.Zoom),
-                         (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+                         (float)SCR_WIDTH / (float)SCR_HEIGHT, NEAR_PLANE,
+                         FAR_PLANE);
     glm::mat4 view = camera.GetViewMatrix();
-    mainShader.setMat4("projection", projection);
-    mainShader.setMat4("view", view);
-    mainShader.setVec3("viewPos", camera.Position);
+    // pixels per unit of model-space size at unit depth in the target
+    // rendered to, for LOD selection
+    float projScale = projection[1][1] * targetHeight * 0.5f;
+    cellGraph.findVisible(camera.Position, projection * view);
+    if (FRUSTUM_CULLING)
+      staticScene.cull(cellGraph);
+    staticPiecesDrawn += staticScene.visibleInstances;
+    cellsVisible += cellGraph.visibleCount();
 
     // ========== LIGHTING ==========
-    // 8 lantern point lights with warm fire color
+    profiler.begin("lighting");
+    // 8 lantern point lights with warm fire color, packed to the front of
+    // the buffer or binned into clusters
+    bool clustered = lightingPath != LIGHTING_UNIFORM_BLOCK;
+    int lightCount = 0;
+    lightClusters.clear();
     for (int i = 0; i < NUM_LANTERNS; i++) {
-      std::string prefix = "pointLights[" + std::to_string(i) + "]";
+      PointLightStd140 light;
       // Slight flicker effect
       float flicker = 0.9f + 0.1f * sin(currentFrame * 8.0f + i * 1.7f);
-      mainShader.setVec3(prefix + ".position",
-                         lanterns[i].position +
-                             glm::vec3(lanterns[i].facingX * 0.3f, 0.3f, 0.0f));
-      
+      light.position = lanterns[i].position +
+                       glm::vec3(lanterns[i].facingX * 0.3f, 0.3f, 0.0f);
+
       if (lanternsOn) {
-        mainShader.setVec3(prefix + ".ambient", 0.06f, 0.04f, 0.02f);
-        mainShader.setVec3(prefix + ".diffuse", 1.0f * flicker, 0.55f * flicker,
-                           0.15f * flicker);
-        mainShader.setVec3(prefix + ".specular", 0.6f, 0.4f, 0.1f);
+        light.ambient = glm::vec3(0.06f, 0.04f, 0.02f);
+        light.diffuse =
+            glm::vec3(1.0f * flicker, 0.55f * flicker, 0.15f * flicker);
+        light.specular = glm::vec3(0.6f, 0.4f, 0.1f);
       } else {
-        mainShader.setVec3(prefix + ".ambient", 0.0f, 0.0f, 0.0f);
-        mainShader.setVec3(prefix + ".diffuse", 0.0f, 0.0f, 0.0f);
-        mainShader.setVec3(prefix + ".specular", 0.0f, 0.0f, 0.0f);
+        light.ambient = glm::vec3(0.0f, 0.0f, 0.0f);
+        light.diffuse = glm::vec3(0.0f, 0.0f, 0.0f);
+        light.specular = glm::vec3(0.0f, 0.0f, 0.0f);
+      }
+      light.constant = 1.0f;
+      light.linear = 0.22f; // Sharper falloff
+      light.quadratic = 0.12f;
+      light.range = lightRange(light);
+      // a lit lantern whose reach misses everything visible is left out; an
+      // unlit one has no range and is kept, contributing nothing, as before
+      if (FRUSTUM_CULLING && light.range > 0.0f &&
+          !cellGraph.intersects(lightBounds(light))) {
+        lightsCulled++;
+        continue;
       }
-      mainShader.setFloat(prefix + ".constant", 1.0f);
-      mainShader.setFloat(prefix + ".linear", 0.22f); // Sharper falloff
-      mainShader.setFloat(prefix + ".quadratic", 0.12f);
+      if (clustered)
+        lightClusters.add(light);
+      else if (lightCount < MAX_POINT_LIGHTS)
+        lightBuffer.setPointLight(lightCount++, light);
     }
-    mainShader.setInt("numPointLights", NUM_LANTERNS);
-
-    // SpotLight (Flashlight) – dim for atmosphere
-    mainShader.setVec3("spotLight.position", camera.Position);
-    mainShader.setVec3("spotLight.direction", camera.Front);
-    
-    if (flashlightOn) {
-      mainShader.setVec3("spotLight.ambient", 0.0f, 0.0f, 0.0f);
-      mainShader.setVec3("spotLight.diffuse", 0.4f, 0.35f, 0.25f); // Dim warm
-      mainShader.setVec3("spotLight.specular", 0.3f, 0.3f, 0.3f);
-    } else {
-      mainShader.setVec3("spotLight.ambient", 0.0f, 0.0f, 0.0f);
-      mainShader.setVec3("spotLight.diffuse", 0.0f, 0.0f, 0.0f); 
-      mainShader.setVec3("spotLight.specular", 0.0f, 0.0f, 0.0f);
+    lightBuffer.setCount(lightCount);
+    lightBuffer.upload();
+    if (clustered) {
+      lightClusters.build(view, projection, NEAR_PLANE, FAR_PLANE);
+      lightClusters.upload();
+      lightCount = lightClusters.lightCount;
+      clusterReferences += lightClusters.referenceCount;
     }
-    
-    mainShader.setFloat("spotLight.constant", 1.0f);
-    mainShader.setFloat("spotLight.linear", 0.14f);
-    mainShader.setFloat("spotLight.quadratic", 0.07f);
-    mainShader.setFloat("spotLight.cutOff", glm::cos(glm::radians(14.0f)));
-    mainShader.setFloat("spotLight.outerCutOff", glm::cos(glm::radians(18.0f)));
-    mainShader.setBool("spotLightOn", flashlightOn);
+    lightsUsed += lightCount;
+
+    // the forward shader lights the scene, or the lighting pass does
+    Shader &litShader = deferred ? deferredShader : mainShader;
+    renderState.useProgram(litShader.ID);
+    setLighting(litShader, deferred ? deferredUniforms : uniforms, clustered,
+                lightClusters, targetWidth, targetHeight);
+    profiler.end();
 
     // ========== DRAW SCENE ==========
-    mainShader.setBool("useEmissive", false);
-    mainShader.setBool("useNormalMap", false);
-    mainShader.setVec2("uvScale", glm::vec2(1.0f, 1.0f));
-
-    // Draw Floor (Continuous)
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, floorTexture);
-    glm::mat4 model = glm::mat4(1.0f);
-    model = glm::translate(model, glm::vec3(0.0f, -1.0f, -15.0f));
-    model = glm::scale(model, glm::vec3(10.0f, 0.1f, 50.0f));
-    mainShader.setMat4("model", model);
-    mainShader.setVec3("objectColor", 0.6f, 0.55f, 0.5f);
-    mainShader.setBool("useTexture", true);
-    mainShader.setVec2("uvScale", glm::vec2(5.0f, 25.0f));
-    cube.draw(mainShader.ID);
-
-    // Segmented Walls, Ceiling, and Dividers
-    for (int i = 0; i < 10; i++) {
-      float zPos = -i * 5.0f;
-
-      // --- 1. Vertical Dividers (Wall Columns) ---
-      mainShader.setBool("useTexture", true);
-      glBindTexture(GL_TEXTURE_2D, pillarTexture);
-      mainShader.setVec3("objectColor", 0.65f, 0.55f, 0.4f);
-      mainShader.setVec2("uvScale", glm::vec2(1.0f, 5.0f)); // Vertical grooves
-      // Left Divider
-      model = glm::mat4(1.0f);
-      model = glm::translate(model, glm::vec3(-4.85f, 1.5f, zPos));
-      model = glm::scale(model, glm::vec3(0.35f, 5.0f, 0.5f));
-      mainShader.setMat4("model", model);
-      cube.draw(mainShader.ID);
-      // Right Divider
-      model = glm::mat4(1.0f);
-      model = glm::translate(model, glm::vec3(4.85f, 1.5f, zPos));
-      model = glm::scale(model, glm::vec3(0.35f, 5.0f, 0.5f));
-      mainShader.setMat4("model", model);
-      cube.draw(mainShader.ID);
-
-      // --- 2. Ceiling Beams ---
-      model = glm::mat4(1.0f);
-      model = glm::translate(model, glm::vec3(0.0f, 3.85f, zPos));
-      model = glm::scale(model, glm::vec3(10.0f, 0.35f, 0.5f));
-      mainShader.setMat4("model", model);
-      cube.draw(mainShader.ID);
-
-      // --- 3. Wall Panels (between dividers) ---
-      mainShader.setBool("useTexture", true);
-      glBindTexture(GL_TEXTURE_2D, wallTexture);
-      mainShader.setVec3("objectColor", 0.7f, 0.6f, 0.4f);
-      mainShader.setVec2("uvScale", glm::vec2(0.8f, 1.0f)); // Large figures
-
-      // Left Panel
-      model = glm::mat4(1.0f);
-      model = glm::translate(model, glm::vec3(-5.0f, 1.5f, zPos - 2.5f));
-      model = glm::scale(model, glm::vec3(0.2f, 5.0f, 4.5f));
-      mainShader.setMat4("model", model);
-      cube.draw(mainShader.ID);
-      // Right Panel
-      model = glm::mat4(1.0f);
-      model = glm::translate(model, glm::vec3(5.0f, 1.5f, zPos - 2.5f));
-      model = glm::scale(model, glm::vec3(0.2f, 5.0f, 4.5f));
-      mainShader.setMat4("model", model);
-      cube.draw(mainShader.ID);
-
-      // --- 4. Ceiling Panels (Now using floor_texture as requested) ---
-      glBindTexture(GL_TEXTURE_2D, floorTexture);
-      model = glm::mat4(1.0f);
-      model = glm::translate(model, glm::vec3(0.0f, 4.05f, zPos - 2.5f));
-      model = glm::scale(model, glm::vec3(10.0f, 0.1f, 4.5f));
-      mainShader.setMat4("model", model);
-      mainShader.setVec3("objectColor", 0.45f, 0.35f, 0.25f);
-      mainShader.setVec2("uvScale", glm::vec2(2.0f, 2.0f));
-      cube.draw(mainShader.ID);
+    if (deferred)
+      gBuffer.bindForGeometry(targetWidth, targetHeight);
+    renderState.useProgram(sceneShader.ID);
+    sceneShader.setMat4(sceneUniforms.projection, projection);
+    sceneShader.setMat4(sceneUniforms.view, view);
+    sceneShader.setBool(sceneUniforms.useEmissive, false);
+    sceneShader.setBool(sceneUniforms.useNormalMap, false);
+    sceneShader.setVec2(sceneUniforms.uvScale, glm::vec2(1.0f, 1.0f));
+
+    // Floor, corridor, back wall, lantern brackets, sarcophagus base
+    // pick up any layers decoded since last frame, then the only texture
+    // bind of the frame
+    if (!materialTextures.ready() && materialTextures.poll())
+      std::cout << "Textures resident after " << msSinceStart() << " ms"
+                << std::endl;
+    materialTextures.bind(0);
+
+    renderQueue.clear();
+    {
+      // floor and corridor are baked into one static draw
+      Profiler::Scope scope(profiler, "static scene");
+      drawStaticScene(sceneShader, sceneUniforms, lightBuffer, cube,
+                      staticScene, renderQueue);
     }
 
-    // Back wall
-    mainShader.setBool("useTexture", true);
-    glBindTexture(GL_TEXTURE_2D, wallTexture); // Fix: Use wall texture
-    model = glm::mat4(1.0f);
-    model = glm::translate(model, glm::vec3(0.0f, 1.5f, -50.0f));
-    model = glm::scale(model, glm::vec3(10.0f, 5.0f, 0.2f));
-    mainShader.setMat4("model", model);
-    mainShader.setVec3("objectColor", 0.7f, 0.6f, 0.4f);
-    mainShader.setVec2("uvScale", glm::vec2(2.0f, 1.0f)); // Wide wall
-    cube.draw(mainShader.ID);
-
-    mainShader.setBool("useTexture", false);
-    mainShader.setVec2("uvScale", glm::vec2(1.0f, 1.0f));
-
     // 4. Pillars removed (as requested)
 
     // 5. Wall-mounted Lanterns
-    for (int i = 0; i < NUM_LANTERNS; i++) {
-      glm::mat4 lm = glm::mat4(1.0f);
-      lm = glm::translate(lm, lanterns[i].position);
-      // Scale facing direction
-      lm = glm::scale(lm, glm::vec3(lanterns[i].facingX, 1.0f, 1.0f));
-      // Pass lanternsOn to drawLantern so we can disable the flame if off
-      drawLantern(mainShader, cube, cylinder, lm, lanternsOn ? currentFrame : 0.0f, lanternTexture);
+    {
+      Profiler::Scope scope(profiler, "lanterns", false);
+      // every flame flickers and sways in step; while the lanterns are off
+      // the flames are hidden and left where they were
+      setChannel(lanternProp, lanternLit, lanternsOn ? 1.0f : 0.0f);
+      if (lanternsOn) {
+        float time = currentFrame;
+        setChannel(lanternProp, flameFlicker[0],
+                   0.82f + 0.18f * sin(time * 9.0f));
+        setChannel(lanternProp, flameFlicker[1],
+                   0.85f + 0.15f * cos(time * 13.0f + 1.1f));
+        setChannel(lanternProp, flameFlicker[2],
+                   0.78f + 0.22f * sin(time * 17.0f + 2.5f));
+        setChannel(lanternProp, flameSwayX, 0.02f * sin(time * 5.0f));
+        setChannel(lanternProp, flameSwayZ, 0.012f * cos(time * 7.0f));
+      }
+      uint32_t changed = changedChannels(lanternProp);
+      for (int i = 0; i < NUM_LANTERNS; i++) {
+        PropInstance &lantern = lanternInstances[i];
+        lanternModel.update(lantern.root, lanternProp.channels.data(),
+                            changed, lantern.world.data());
+        glm::vec3 center(lantern.world[lanternCenterPart][3]);
+        glm::vec3 radius(LANTERN_BOUNDING_RADIUS);
+        if (FRUSTUM_CULLING &&
+            !cellGraph.intersects({center - radius, center + radius}))
+          continue;
+        lanternsDrawn++;
+        submitProp(renderQueue, cylinder, lanternProp, lantern, nullptr,
+                   view, projScale);
+      }
     }
 
     // 7. Sarcophagus (Hierarchical + Interactive)
-    glm::mat4 sarcPos = glm::mat4(1.0f);
-    sarcPos = glm::translate(sarcPos, glm::vec3(0.0f, -0.5f, -20.0f));
-    drawSarcophagus(mainShader, cube, sarcPos, sarcophagusSlide,
-                    graveyardTexture);
+    {
+      Profiler::Scope scope(profiler, "sarcophagus", false);
+      setChannel(sarcophagusProp, lidSlide, sarcophagusSlide);
+      sarcophagusProp.model.update(
+          sarcophagusInstance.root, sarcophagusProp.channels.data(),
+          changedChannels(sarcophagusProp), sarcophagusInstance.world.data());
+      // the lid is culled on its own
+      submitProp(renderQueue, cylinder, sarcophagusProp, sarcophagusInstance,
+                 FRUSTUM_CULLING ? &cellGraph : nullptr, view, projScale);
+    }
+
+    // opaque items first; on the deferred path only they go to the G-buffer
+    const std::vector<uint32_t> &order = renderQueue.sort(view);
+    size_t opaque = renderQueue.opaqueCount;
+    {
+      Profiler::Scope scope(profiler, "render queue");
+      drawQueue(sceneShader, sceneUniforms, lightBuffer, cube, cylinder,
+                renderQueue, order, 0, deferred ? opaque : order.size());
+    }
+
+    if (deferred) {
+      {
+        // light every covered pixel once
+        Profiler::Scope scope(profiler, "deferred lighting");
+        if (offscreen) {
+          offscreen->bind();
+        } else {
+          glBindFramebuffer(GL_FRAMEBUFFER, 0);
+          glViewport(0, 0, framebufferWidth, framebufferHeight);
+        }
+        renderState.useProgram(deferredShader.ID);
+        deferredShader.setMat4(deferredUniforms.view, view);
+        deferredShader.setMat4(deferredUniforms.inverseViewProjection,
+                               glm::inverse(projection * view));
+        gBuffer.bindTextures(GBUFFER_TEXTURE_UNIT);
+        // the pass writes the G-buffer's depth for the flames to test against
+        renderState.depthFunc(GL_ALWAYS);
+        gBuffer.drawFullscreen();
+        renderState.depthFunc(GL_LESS);
+      }
+
+      // then the flames on top, forward
+      Profiler::Scope scope(profiler, "flames");
+      renderState.useProgram(mainShader.ID);
+      mainShader.setMat4(uniforms.projection, projection);
+      mainShader.setMat4(uniforms.view, view);
+      drawQueue(mainShader, uniforms, lightBuffer, cube, cylinder,
+                renderQueue, order, opaque, order.size());
+    }
 
+    statsFrames++;
+    statsTimer += deltaTime;
+    if (statsTimer >= 1.0f) {
+      unsigned int lookupsSaved = 0;
+      for (Shader *shader : shaders) {
+        lookupsSaved += shader->takeLookupsSaved();
+        shader->takeUniformWrites(glCallsIssued, glCallsSkipped);
+      }
+      renderState.takeCalls(glCallsIssued, glCallsSkipped);
+      std::string title =
+          "The Crypt of Thoth | uniform lookups avoided/frame: " +
+          std::to_string(lookupsSaved / statsFrames) +
+          " | cylinder tris/frame: " +
+          std::to_string(cylinderTriangles / statsFrames) +
+          " | static pieces/frame: " +
+          std::to_string(staticPiecesDrawn / statsFrames) + " of " +
+          std::to_string(staticScene.size()) + ", lanterns " +
+          std::to_string(lanternsDrawn / statsFrames) + " of " +
+          std::to_string(NUM_LANTERNS) + ", cells " +
+          std::to_string(cellsVisible / statsFrames) + " of " +
+          std::to_string(cellGraph.cells.size()) + ", lights " +
+          std::to_string(lightsUsed / statsFrames) + " (" +
+          lightingPathNames[lightingPath] + ", " +
+          std::to_string(lightsCulled / statsFrames) + " culled, " +
+          (litDraws ? std::to_string(drawLightRefs / litDraws) + " per draw, "
+                    : std::string()) +
+          std::to_string(clusterReferences / statsFrames) +
+          " cluster refs)" + " | GL state/uniform calls issued/skipped per frame: " +
+          std::to_string(glCallsIssued / statsFrames) + "/" +
+          std::to_string(glCallsSkipped / statsFrames) +
+          " | cpu/gpu ms: " + profiler.takeSummary();
+      glfwSetWindowTitle(window, title.c_str());
+      statsTimer = 0.0f;
+      statsFrames = 0;
+      cylinderTriangles = 0;
+      staticPiecesDrawn = lanternsDrawn = 0;
+      cellsVisible = lightsUsed = lightsCulled = clusterReferences = 0;
+      litDraws = drawLightRefs = 0;
+      glCallsIssued = glCallsSkipped = 0;
+    }
+
+    if (offscreen && headless.shouldCapture(frameIndex))
+      offscreen->saveFrame(headless.captureDir, frameIndex);
+    frameIndex++;
+    if (headless.frames > 0 && frameIndex >= headless.frames)
+      glfwSetWindowShouldClose(window, true);
+    if (benchmark && currentFrame >= benchmarkPath.duration())
+      glfwSetWindowShouldClose(window, true);
+
+    auto submitEnd = std::chrono::steady_clock::now();
+    profiler.begin("swap", false);
     glfwSwapBuffers(window);
+    profiler.end();
     glfwPollEvents();
+    if (benchmark) {
+      // with no swap to wait on, finish the GPU work so it is counted
+      if (offscreen)
+        glFinish();
+      auto frameEnd = std::chrono::steady_clock::now();
+      frameStats.add(
+          currentFrame,
+          std::chrono::duration<double, std::milli>(frameEnd - frameStart)
+              .count(),
+          std::chrono::duration<double, std::milli>(submitEnd - frameStart)
+              .count());
+    }
+    if (firstFrame) {
+      std::cout << "First frame after " << msSinceStart() << " ms"
+                << std::endl;
+      firstFrame = false;
+    }
   }
 
-  stopBackgroundMusic();
+  if (benchmark)
+    frameStats.writeCSV(headless.benchmarkCsv);
+  if (!headless.traceJson.empty())
+    profiler.writeChromeTrace(headless.traceJson);
+  if (!headless.enabled)
+    stopBackgroundMusic();
+  offscreen.reset();
   glfwTerminate();
   return 0;
 }
@@ -368,6 +779,31 @@ void processInput(GLFWwindow *window) {
     lKeyPressed = false;
   }
 
+  static bool iKeyPressed = false;
+  if (glfwGetKey(window, GLFW_KEY_I) == GLFW_PRESS) {
+    if (!iKeyPressed) {
+      staticPath = static_cast<StaticRenderPath>((staticPath + 1) % 3); // Cycle
+      std::cout << "Static scene: " << staticPathNames[staticPath]
+                << std::endl;
+      iKeyPressed = true;
+    }
+  } else {
+    iKeyPressed = false;
+  }
+
+  static bool cKeyPressed = false;
+  if (glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS) {
+    if (!cKeyPressed) {
+      lightingPath = static_cast<LightingPath>((lightingPath + 1) %
+                                               LIGHTING_PATH_COUNT); // Cycle
+      std::cout << "Lighting: " << lightingPathNames[lightingPath]
+                << std::endl;
+      cKeyPressed = true;
+    }
+  } else {
+    cKeyPressed = false;
+  }
+
   if (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS) {
     // Reset camera position and orientation
     camera.Position = glm::vec3(0.0f, 1.5f, 10.0f);
@@ -380,11 +816,7 @@ void processInput(GLFWwindow *window) {
   static bool eKeyPressed = false;
   if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS) {
     if (!eKeyPressed) {
-      float dist = glm::length(camera.Position - glm::vec3(0.0f, 0.0f, -20.0f));
-      if (dist < 5.0f) {
-        sarcophagusInteract = true;
-        sarcophagusOpen = !sarcophagusOpen; // Toggle
-      }
+      interactWithSarcophagus();
       eKeyPressed = true;
     }
   } else {
@@ -392,7 +824,139 @@ void processInput(GLFWwindow *window) {
   }
 }
 
+// Open or close the lid if the camera is close enough
+void interactWithSarcophagus() {
+  float dist = glm::length(camera.Position - glm::vec3(0.0f, 0.0f, -20.0f));
+  if (dist < 5.0f) {
+    sarcophagusInteract = true;
+    sarcophagusOpen = !sarcophagusOpen; // Toggle
+  }
+}
+
+// Down the corridor turning to face each lantern as it is passed, back to
+// the sarcophagus, then watch the lid slide open (at
+// BENCHMARK_OPEN_LID_TIME). Walks off-centre so it never clips the
+// sarcophagus.
+CameraPath buildBenchmarkPath() {
+  CameraPath path;
+  path.add(0.0f, glm::vec3(0.0f, 1.5f, 10.0f), -90.0f, 0.0f);
+  path.add(2.0f, glm::vec3(0.0f, 1.5f, 2.0f), -90.0f, 0.0f);
+
+  std::vector<LanternInfo> byDepth(lanterns, lanterns + NUM_LANTERNS);
+  std::sort(byDepth.begin(), byDepth.end(),
+            [](const LanternInfo &a, const LanternInfo &b) {
+              return a.position.z > b.position.z;
+            });
+  float time = 2.0f;
+  for (const LanternInfo &lantern : byDepth) {
+    time += 1.5f;
+    glm::vec3 eye(1.5f, 1.5f, lantern.position.z + 2.5f);
+    glm::vec3 to = lantern.position - eye;
+    float yaw = glm::degrees(std::atan2(to.z, to.x));
+    float pitch = glm::degrees(std::atan2(to.y, glm::length(glm::vec2(to.x,
+                                                                     to.z))));
+    path.add(time, eye, yaw, pitch);
+  }
+
+  // turn round at the far wall and come back to the sarcophagus
+  path.add(time + 1.5f, glm::vec3(1.5f, 1.5f, -36.0f), 90.0f, 0.0f);
+  path.add(BENCHMARK_OPEN_LID_TIME, glm::vec3(1.5f, 1.8f, -16.5f), 250.0f,
+           -30.0f);
+  path.add(BENCHMARK_OPEN_LID_TIME + 3.5f, glm::vec3(1.5f, 1.8f, -16.5f),
+           250.0f, -30.0f);
+  return path;
+}
+
+SceneUniforms cacheSceneUniforms(const Shader &shader) {
+  SceneUniforms uniforms;
+  uniforms.model = shader.uniform("model");
+  uniforms.view = shader.uniform("view");
+  uniforms.projection = shader.uniform("projection");
+  uniforms.viewPos = shader.uniform("viewPos");
+  uniforms.inverseViewProjection = shader.uniform("inverseViewProjection");
+  uniforms.objectColor = shader.uniform("objectColor");
+  uniforms.useTexture = shader.uniform("useTexture");
+  uniforms.useNormalMap = shader.uniform("useNormalMap");
+  uniforms.uvScale = shader.uniform("uvScale");
+  uniforms.textureLayer = shader.uniform("textureLayer");
+  uniforms.useEmissive = shader.uniform("useEmissive");
+  uniforms.emissiveColor = shader.uniform("emissiveColor");
+  uniforms.useInstancing = shader.uniform("useInstancing");
+  uniforms.spotLightOn = shader.uniform("spotLightOn");
+  uniforms.useClusters = shader.uniform("useClusters");
+  uniforms.numClusteredLights = shader.uniform("numClusteredLights");
+  uniforms.clusterScale = shader.uniform("clusterScale");
+  uniforms.clusterDepth = shader.uniform("clusterDepth");
+  uniforms.drawLightMask = shader.uniform("drawLightMask");
+
+  SpotLightUniforms &sl = uniforms.spotLight;
+  sl.position = shader.uniform("spotLight.position");
+  sl.direction = shader.uniform("spotLight.direction");
+  sl.ambient = shader.uniform("spotLight.ambient");
+  sl.diffuse = shader.uniform("spotLight.diffuse");
+  sl.specular = shader.uniform("spotLight.specular");
+  sl.constant = shader.uniform("spotLight.constant");
+  sl.linear = shader.uniform("spotLight.linear");
+  sl.quadratic = shader.uniform("spotLight.quadratic");
+  sl.cutOff = shader.uniform("spotLight.cutOff");
+  sl.outerCutOff = shader.uniform("spotLight.outerCutOff");
+  return uniforms;
+}
+
+// Camera position, the lantern lights' source and the flashlight, for a
+// shader that lights the scene (the forward shader or the deferred lighting
+// pass), which must be bound. width x height is the target's size, for
+// finding a pixel's light cluster.
+void setLighting(Shader &shader, const SceneUniforms &u, bool clustered,
+                 const LightClusters &clusters, int width, int height) {
+  shader.setVec3(u.viewPos, camera.Position);
+  shader.setBool(u.useClusters, clustered);
+  if (clustered) {
+    shader.setInt(u.numClusteredLights, clusters.lightCount);
+    shader.setVec2(u.clusterScale, glm::vec2((float)CLUSTER_X / width,
+                                             (float)CLUSTER_Y / height));
+    shader.setVec2(u.clusterDepth, clusters.depthSlicing());
+  }
+
+  // SpotLight (Flashlight) – dim for atmosphere
+  shader.setVec3(u.spotLight.position, camera.Position);
+  shader.setVec3(u.spotLight.direction, camera.Front);
+
+  if (flashlightOn) {
+    shader.setVec3(u.spotLight.ambient, 0.0f, 0.0f, 0.0f);
+    shader.setVec3(u.spotLight.diffuse, 0.4f, 0.35f, 0.25f); // Dim warm
+    shader.setVec3(u.spotLight.specular, 0.3f, 0.3f, 0.3f);
+  } else {
+    shader.setVec3(u.spotLight.ambient, 0.0f, 0.0f, 0.0f);
+    shader.setVec3(u.spotLight.diffuse, 0.0f, 0.0f, 0.0f);
+    shader.setVec3(u.spotLight.specular, 0.0f, 0.0f, 0.0f);
+  }
+
+  shader.setFloat(u.spotLight.constant, 1.0f);
+  shader.setFloat(u.spotLight.linear, 0.14f);
+  shader.setFloat(u.spotLight.quadratic, 0.07f);
+  shader.setFloat(u.spotLight.cutOff, glm::cos(glm::radians(14.0f)));
+  shader.setFloat(u.spotLight.outerCutOff, glm::cos(glm::radians(18.0f)));
+  shader.setBool(u.spotLightOn, flashlightOn);
+}
+
+// Light the next draw, which lies within bounds, with only the LightBlock
+// lights that reach it. The clustered and deferred paths leave the
+// LightBlock empty and pick lights per fragment, so there is nothing to do.
+void setDrawLights(Shader &shader, const SceneUniforms &u,
+                   const LightBuffer &lights, const AABB &bounds) {
+  if (lightingPath != LIGHTING_UNIFORM_BLOCK)
+    return;
+  int mask = lights.reachMask(bounds);
+  shader.setInt(u.drawLightMask, mask);
+  litDraws++;
+  for (; mask != 0; mask &= mask - 1)
+    drawLightRefs++;
+}
+
 void framebuffer_size_callback(GLFWwindow *window, int width, int height) {
+  framebufferWidth = width;
+  framebufferHeight = height;
   glViewport(0, 0, width, height);
 }
 void mouse_callback(GLFWwindow *window, double xpos, double ypos) {
@@ -415,171 +979,301 @@ void scroll_callback(GLFWwindow *window, double xoffset, double yoffset) {
   camera.ProcessMouseScroll(yoffset);
 }
 
-void drawPillar(Shader &shader, Cube &cube, glm::mat4 model) {
-  // Base
-  glm::mat4 base = glm::translate(model, glm::vec3(0.0f, -0.5f, 0.0f));
-  base = glm::scale(base, glm::vec3(1.0f, 1.0f, 1.0f));
-  shader.setMat4("model", base);
-  shader.setVec3("objectColor", 0.6f, 0.6f, 0.5f);
-  cube.draw(shader.ID);
-
-  // Shaft
-  glm::mat4 shaft = glm::translate(model, glm::vec3(0.0f, 1.5f, 0.0f));
-  shaft = glm::scale(shaft, glm::vec3(0.8f, 3.0f, 0.8f));
-  shader.setMat4("model", shaft);
-  cube.draw(shader.ID);
-
-  // Capital
-  glm::mat4 cap = glm::translate(model, glm::vec3(0.0f, 3.2f, 0.0f));
-  cap = glm::scale(cap, glm::vec3(1.2f, 0.4f, 1.2f));
-  shader.setMat4("model", cap);
-  cube.draw(shader.ID);
+// Record every static piece of the tomb once. The corridor alone is 7 pieces
+// per segment; instanced, the whole scene is one draw per material however
+// many segments there are.
+void buildStaticScene(StaticScene &scene) {
+  // Floor (Continuous)
+  glm::mat4 model =
+      glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -1.0f, -15.0f));
+  model = glm::scale(model, glm::vec3(10.0f, 0.1f, 50.0f));
+  scene.add(MATERIAL_FLOOR, model, glm::vec2(5.0f, 25.0f),
+            glm::vec3(0.6f, 0.55f, 0.5f));
+
+  // Segmented Walls, Ceiling, and Dividers
+  glm::vec2 pillarUV(1.0f, 5.0f); // Vertical grooves
+  glm::vec3 pillarColor(0.65f, 0.55f, 0.4f);
+  glm::vec2 wallUV(0.8f, 1.0f); // Large figures
+  glm::vec3 wallColor(0.7f, 0.6f, 0.4f);
+  glm::vec2 ceilingUV(2.0f, 2.0f);
+  glm::vec3 ceilingColor(0.45f, 0.35f, 0.25f);
+
+  for (int i = 0; i < CORRIDOR_SEGMENTS; i++) {
+    float zPos = -i * 5.0f;
+
+    // Dividers and ceiling beam
+    model = glm::translate(glm::mat4(1.0f), glm::vec3(-4.85f, 1.5f, zPos));
+    model = glm::scale(model, glm::vec3(0.35f, 5.0f, 0.5f));
+    scene.add(MATERIAL_PILLAR, model, pillarUV, pillarColor);
+    model = glm::translate(glm::mat4(1.0f), glm::vec3(4.85f, 1.5f, zPos));
+    model = glm::scale(model, glm::vec3(0.35f, 5.0f, 0.5f));
+    scene.add(MATERIAL_PILLAR, model, pillarUV, pillarColor);
+    model = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 3.85f, zPos));
+    model = glm::scale(model, glm::vec3(10.0f, 0.35f, 0.5f));
+    scene.add(MATERIAL_PILLAR, model, pillarUV, pillarColor);
+
+    // Wall panels
+    model = glm::translate(glm::mat4(1.0f),
+                           glm::vec3(-5.0f, 1.5f, zPos - 2.5f));
+    model = glm::scale(model, glm::vec3(0.2f, 5.0f, 4.5f));
+    scene.add(MATERIAL_WALL, model, wallUV, wallColor);
+    model = glm::translate(glm::mat4(1.0f), glm::vec3(5.0f, 1.5f, zPos - 2.5f));
+    model = glm::scale(model, glm::vec3(0.2f, 5.0f, 4.5f));
+    scene.add(MATERIAL_WALL, model, wallUV, wallColor);
+
+    // Ceiling panel (floor texture)
+    model = glm::translate(glm::mat4(1.0f),
+                           glm::vec3(0.0f, 4.05f, zPos - 2.5f));
+    model = glm::scale(model, glm::vec3(10.0f, 0.1f, 4.5f));
+    scene.add(MATERIAL_FLOOR, model, ceilingUV, ceilingColor);
+  }
+
+  // Back wall
+  model = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 1.5f, -50.0f));
+  model = glm::scale(model, glm::vec3(10.0f, 5.0f, 0.2f));
+  scene.add(MATERIAL_WALL, model, glm::vec2(2.0f, 1.0f), // Wide wall
+            glm::vec3(0.7f, 0.6f, 0.4f));
+
+  // Static parts of the props: lantern wall brackets, sarcophagus base
+  for (int i = 0; i < NUM_LANTERNS; i++)
+    bakeProp(scene, lanternProp, lanternInstances[i]);
+  bakeProp(scene, sarcophagusProp, sarcophagusInstance);
+
+  scene.build();
 }
 
-void drawSarcophagus(Shader &shader, Cube &cube, glm::mat4 parentModel,
-                     float slideAmount, unsigned int textureID) {
-  // Common texture setup
-  shader.setBool("useTexture", true);
-  glBindTexture(GL_TEXTURE_2D, textureID);
-  shader.setVec2("uvScale", glm::vec2(1.0f, 1.0f));
-
-  // Base
-  glm::mat4 base = glm::scale(parentModel, glm::vec3(1.5f, 1.0f, 3.0f));
-  shader.setMat4("model", base);
-  shader.setVec3("objectColor", 1.0f, 0.9f, 0.8f); // Bright base for texture
-  cube.draw(shader.ID);
-
-  // Lid (Sliding)
-  glm::mat4 lid = glm::translate(
-      parentModel, glm::vec3(0.0f, 0.6f, slideAmount)); // Slide along Z
-  lid = glm::scale(lid, glm::vec3(1.6f, 0.2f, 3.1f));
-  shader.setMat4("model", lid);
-  shader.setVec3("objectColor", 1.0f, 1.0f, 1.0f); // Bright for lid detail
-  cube.draw(shader.ID);
+// One cell per corridor segment plus the open end in front of the entrance,
+// joined by the doorways between the divider pillars and under the beams
+void buildCellGraph(CellGraph &graph) {
+  // inner faces of the dividers, the floor's top and the beams' underside
+  const float doorX = 4.85f - 0.175f;
+  const float doorBottom = -1.0f + 0.05f, doorTop = 3.85f - 0.175f;
+  // out to the outer faces of the walls and from floor to ceiling
+  glm::vec3 low(-5.1f, -1.05f, 0.0f), high(5.1f, 4.1f, 0.0f);
+
+  int previous = graph.addCell({glm::vec3(low.x, low.y, 0.0f),
+                                glm::vec3(high.x, high.y, 15.0f)});
+  for (int i = 0; i < CORRIDOR_SEGMENTS; i++) {
+    float zPos = -i * 5.0f;
+    int cell = graph.addCell({glm::vec3(low.x, low.y, zPos - 5.0f),
+                              glm::vec3(high.x, high.y, zPos)});
+    graph.addPortal(previous, cell, glm::vec3(-doorX, doorBottom, zPos),
+                    glm::vec3(doorX, doorBottom, zPos),
+                    glm::vec3(doorX, doorTop, zPos),
+                    glm::vec3(-doorX, doorTop, zPos));
+    previous = cell;
+  }
 }
 
-void drawLantern(Shader &shader, Cube &cube, Cylinder &cyl, glm::mat4 model,
-                 float time, unsigned int textureID) {
-  // 1. Wall bracket — extends straight out from wall
-  shader.setBool("useEmissive", false); // Must be false to see texture!
-  shader.setBool("useTexture", true);
-  shader.setVec2("uvScale", glm::vec2(1.0f, 1.0f)); // Reset scale
-  glBindTexture(GL_TEXTURE_2D, textureID);
-  shader.setVec3("objectColor", 1.0f, 1.0f,
-                 1.0f); // Bright base for dark texture
-
-  // Horizontal arm
-  glm::mat4 bracket = glm::translate(model, glm::vec3(0.2f, 0.0f, 0.0f));
-  bracket = glm::scale(bracket, glm::vec3(0.4f, 0.06f, 0.06f));
-  shader.setMat4("model", bracket);
-  cube.draw(shader.ID);
-
-  // 2. Torch handle — vertical, at end of bracket
-  glm::mat4 torchBase = glm::translate(model, glm::vec3(0.4f, 0.0f, 0.0f));
-
-  glm::mat4 handleGeom =
-      glm::translate(torchBase, glm::vec3(0.0f, 0.15f, 0.0f));
-  handleGeom = glm::scale(handleGeom, glm::vec3(0.05f, 0.5f, 0.05f));
-  shader.setMat4("model", handleGeom);
-  cyl.draw(shader.ID);
-
-  // 3. Metal cup at top — holds the fire
-  glm::mat4 cup = glm::translate(torchBase, glm::vec3(0.0f, 0.4f, 0.0f));
-
-  glm::mat4 cupGeom = glm::scale(cup, glm::vec3(0.1f, 0.08f, 0.1f));
-  shader.setMat4("model", cupGeom);
-  cyl.draw(shader.ID);
-
-  // 4. FIRE — additive blending
-  if (time > 0.0f) { // Only draw fire if time is advancing (lanterns are ON)
-    shader.setBool("useTexture", false);
-    shader.setBool("useEmissive", true);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE); // Additive blending
-    glDepthMask(GL_FALSE);             // Don't write depth for transparent fire
-
-    float fl1 = 0.82f + 0.18f * sin(time * 9.0f);
-    float fl2 = 0.85f + 0.15f * cos(time * 13.0f + 1.1f);
-    float fl3 = 0.78f + 0.22f * sin(time * 17.0f + 2.5f);
-    float swayX = 0.02f * sin(time * 5.0f);
-    float swayZ = 0.012f * cos(time * 7.0f);
-
-    // Base glow (wide, deep red-orange)
-    shader.setVec3("emissiveColor", 0.6f, 0.15f, 0.02f);
-    glm::mat4 fb =
-        glm::translate(cup, glm::vec3(swayX * 0.3f, 0.08f, swayZ * 0.3f));
-    fb = glm::scale(fb, glm::vec3(0.09f * fl1, 0.07f, 0.09f * fl1));
-    shader.setMat4("model", fb);
-    cyl.draw(shader.ID);
-
-    // Lower flame (orange)
-    shader.setVec3("emissiveColor", 1.0f, 0.35f, 0.04f);
-    glm::mat4 f1 =
-        glm::translate(cup, glm::vec3(swayX * 0.6f, 0.14f, swayZ * 0.5f));
-    f1 = glm::scale(f1, glm::vec3(0.065f * fl2, 0.10f * fl1, 0.065f * fl2));
-    shader.setMat4("model", f1);
-    cyl.draw(shader.ID);
-
-    // Mid flame (bright orange)
-    shader.setVec3("emissiveColor", 1.0f, 0.55f, 0.08f);
-    glm::mat4 f2 = glm::translate(cup, glm::vec3(swayX, 0.22f, swayZ * 0.8f));
-    f2 = glm::scale(f2, glm::vec3(0.045f * fl3, 0.12f * fl2, 0.045f * fl3));
-    shader.setMat4("model", f2);
-    cyl.draw(shader.ID);
-
-    // Upper flame (yellow, narrowing)
-    shader.setVec3("emissiveColor", 1.0f, 0.75f, 0.15f);
-    glm::mat4 f3 = glm::translate(cup, glm::vec3(swayX * 1.5f, 0.32f, swayZ));
-    f3 = glm::scale(f3, glm::vec3(0.028f * fl1, 0.10f * fl3, 0.028f * fl1));
-    shader.setMat4("model", f3);
-    cyl.draw(shader.ID);
-
-    // Flame tip (bright yellow-white wisp)
-    shader.setVec3("emissiveColor", 1.0f, 0.9f, 0.45f);
-    glm::mat4 f4 =
-        glm::translate(cup, glm::vec3(swayX * 2.0f, 0.40f, swayZ * 1.5f));
-    f4 = glm::scale(f4, glm::vec3(0.012f, 0.08f * fl2, 0.012f));
-    shader.setMat4("model", f4);
-    cyl.draw(shader.ID);
-
-    // Restore normal blending
-    glDepthMask(GL_TRUE);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    shader.setBool("useEmissive", false);
+// Load a prop's model and resolve its mesh and material names. Parts drawn
+// with a texture must name a material.
+bool loadProp(Prop &prop, const char *path) {
+  if (!prop.model.load(path))
+    return false;
+  const Model &model = prop.model;
+  // in DrawMesh and Material order
+  static const char *meshNames[] = {"cube", "cylinder", "cylinder_open"};
+  const int meshCount = sizeof(meshNames) / sizeof(meshNames[0]);
+  static const char *materialNames[] = {"floor", "pillar", "wall", "lantern",
+                                        "graveyard"};
+  prop.meshes.clear();
+  for (const std::string &name : model.meshNames) {
+    int mesh = 0;
+    while (mesh < meshCount && name != meshNames[mesh])
+      mesh++;
+    if (mesh == meshCount) {
+      std::cout << path << ": unknown mesh " << name << std::endl;
+      return false;
+    }
+    prop.meshes.push_back((DrawMesh)mesh);
   }
+  prop.materials.clear();
+  for (const std::string &name : model.materialNames) {
+    int material = 0;
+    while (material < MATERIAL_COUNT && name != materialNames[material])
+      material++;
+    if (material == MATERIAL_COUNT) {
+      std::cout << path << ": unknown material " << name << std::endl;
+      return false;
+    }
+    prop.materials.push_back(material);
+  }
+  for (size_t i = 0; i < model.size(); i++) {
+    if (model.mesh[i] >= 0 && model.material[i] < 0 &&
+        !(model.flags[i] & PART_EMISSIVE)) {
+      std::cout << path << ": part " << model.name[i] << " has no material"
+                << std::endl;
+      return false;
+    }
+  }
+  prop.channels.assign(model.channelNames.size(), 0.0f);
+  prop.posed = prop.channels;
+  return true;
+}
+
+void placeProp(const Prop &prop, PropInstance &instance,
+               const glm::mat4 &root) {
+  instance.root = root;
+  instance.world.resize(prop.model.size());
+  prop.model.evaluate(root, prop.posed.data(), instance.world.data());
+}
+
+// Channels the model does not use come back from Model::channel as -1 and
+// are ignored here
+void setChannel(Prop &prop, int channel, float value) {
+  if (channel >= 0)
+    prop.channels[channel] = value;
+}
+
+// Mask of the channels set to a new value since the last call, for
+// Model::update on every placement of the prop
+uint32_t changedChannels(Prop &prop) {
+  uint32_t changed = 0;
+  for (size_t c = 0; c < prop.channels.size(); c++) {
+    if (prop.channels[c] != prop.posed[c])
+      changed |= 1u << c;
+  }
+  prop.posed = prop.channels;
+  return changed;
+}
+
+// Opaque static cubes are baked into the static scene, which only draws
+// cubes; every other part is submitted each frame
+bool partBaked(const Prop &prop, int part) {
+  const Model &model = prop.model;
+  return model.mesh[part] >= 0 &&
+         prop.meshes[model.mesh[part]] == MESH_CUBE &&
+         (model.flags[part] & (PART_STATIC | PART_EMISSIVE |
+                               PART_ADDITIVE)) == PART_STATIC;
 }
 
-unsigned int loadTexture(const char *path) {
-  unsigned int textureID;
-  glGenTextures(1, &textureID);
-
-  int width, height, nrComponents;
-  unsigned char *data = stbi_load(path, &width, &height, &nrComponents, 0);
-  if (data) {
-    GLenum format;
-    if (nrComponents == 1)
-      format = GL_RED;
-    else if (nrComponents == 3)
-      format = GL_RGB;
-    else if (nrComponents == 4)
-      format = GL_RGBA;
-
-    glBindTexture(GL_TEXTURE_2D, textureID);
-    glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format,
-                 GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
-                    GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    stbi_image_free(data);
+void bakeProp(StaticScene &scene, const Prop &prop,
+              const PropInstance &instance) {
+  const Model &model = prop.model;
+  for (size_t i = 0; i < model.size(); i++) {
+    if (partBaked(prop, (int)i))
+      scene.add((Material)prop.materials[model.material[i]],
+                instance.world[i], model.uvScale[i], model.color[i]);
+  }
+}
+
+// Static geometry from the baked scene, drawn with the selected path. Every
+// path reads baked values; none of them builds a matrix per frame. Only the
+// cells left visible by the last StaticScene::cull are drawn.
+void drawStaticScene(Shader &shader, const SceneUniforms &u,
+                     const LightBuffer &lights, Cube &cube,
+                     StaticScene &scene, RenderQueue &queue) {
+  if (staticPath == STATIC_IMMEDIATE) {
+    // one queue item per piece, sorted by material with the dynamic draws
+    for (const StaticCell &range : scene.visibleRanges) {
+      for (int i = range.first; i < range.first + range.count; i++) {
+        const CubeInstance &piece = scene.batch.instances[i];
+        queue.submit({MESH_CUBE, 0, scene.materials[i], piece.color,
+                      piece.uvScale, BLEND_OPAQUE, piece.model});
+      }
+    }
+    return;
+  }
+  shader.setBool(u.useTexture, true);
+  if (staticPath == STATIC_MERGED) {
+    // vertices are already in world space with uvScale applied
+    shader.setMat4(u.model, glm::mat4(1.0f));
+    shader.setVec2(u.uvScale, glm::vec2(1.0f, 1.0f));
+    // one draw per material and colour spans every visible cell
+    setDrawLights(shader, u, lights, scene.visibleBounds);
+    for (const MergedMesh &mesh : scene.merged) {
+      shader.setFloat(u.textureLayer, (float)mesh.material);
+      shader.setVec3(u.objectColor, mesh.color);
+      mesh.draw(scene.cellVisible);
+    }
   } else {
-    std::cout << "Texture failed to load at path: " << path << std::endl;
-    stbi_image_free(data);
+    // colors, uvScale and texture layer travel with each instance, so each
+    // run of visible cells is one draw across all materials
+    shader.setBool(u.useInstancing, true);
+    for (const StaticCell &range : scene.visibleRanges) {
+      setDrawLights(shader, u, lights, range.bounds);
+      cube.drawInstanced(scene.batch, range.first, range.count);
+    }
+    shader.setBool(u.useInstancing, false);
+  }
+  shader.setBool(u.useTexture, false);
+  shader.setVec2(u.uvScale, glm::vec2(1.0f, 1.0f));
+}
+
+// Queue the visible, unbaked parts of a placed prop. With a visibility
+// graph each part is culled against it on its own. Cylinders are queued at
+// the coarsest LOD that still looks round at their projected size; textured
+// parts use color as the object color, emissive ones (layer -1) as the
+// emissive color.
+void submitProp(RenderQueue &queue, const Cylinder &cyl, const Prop &prop,
+                const PropInstance &instance, const CellGraph *visibility,
+                const glm::mat4 &view, float projScale) {
+  const Model &model = prop.model;
+  for (size_t i = 0; i < model.size(); i++) {
+    if (model.mesh[i] < 0 || partBaked(prop, (int)i) ||
+        !model.visible((int)i, prop.channels.data()))
+      continue;
+    const glm::mat4 &world = instance.world[i];
+    // cylinders fit in the unit cube too
+    if (visibility && !visibility->intersects(cubeBounds(world)))
+      continue;
+    DrawMesh mesh = prop.meshes[model.mesh[i]];
+    int lod = mesh == MESH_CUBE
+                  ? 0
+                  : cyl.selectLod(projectedDiameter(
+                        world, Cylinder::BOUNDING_RADIUS, view, projScale));
+    int layer = (model.flags[i] & PART_EMISSIVE)
+                    ? -1
+                    : prop.materials[model.material[i]];
+    BlendMode blend =
+        (model.flags[i] & PART_ADDITIVE) ? BLEND_ADDITIVE : BLEND_OPAQUE;
+    queue.submit(
+        {mesh, lod, layer, model.color[i], model.uvScale[i], blend, world});
   }
+}
+
+// Draw items order[first, last) of the sorted queue. Each item sets its
+// full state; what repeats from the previous item is dropped by RenderState
+// and the uniform cache, so a run of same-material items costs only model
+// matrices.
+void drawQueue(Shader &shader, const SceneUniforms &u,
+               const LightBuffer &lights, Cube &cube, Cylinder &cyl,
+               const RenderQueue &queue, const std::vector<uint32_t> &order,
+               size_t first, size_t last) {
+  for (size_t n = first; n < last; n++) {
+    const DrawItem &item = queue.items[order[n]];
+    bool additive = item.blend == BLEND_ADDITIVE;
+    renderState.enable(GL_BLEND, additive);
+    if (additive)
+      renderState.blendFunc(GL_SRC_ALPHA, GL_ONE);
+    renderState.depthMask(!additive); // transparent fire writes no depth
+
+    bool emissive = item.layer < 0;
+    shader.setBool(u.useTexture, !emissive);
+    shader.setBool(u.useEmissive, emissive);
+    if (emissive) {
+      shader.setVec3(u.emissiveColor, item.color);
+    } else {
+      shader.setFloat(u.textureLayer, (float)item.layer);
+      shader.setVec3(u.objectColor, item.color);
+      shader.setVec2(u.uvScale, item.uvScale);
+      // cylinders fit in the unit cube too
+      setDrawLights(shader, u, lights, cubeBounds(item.model));
+    }
+    shader.setMat4(u.model, item.model);
 
-  return textureID;
+    if (item.mesh == MESH_CUBE) {
+      cube.draw(shader.ID);
+    } else {
+      bool caps = item.mesh == MESH_CYLINDER;
+      cyl.draw(shader.ID, item.lod, caps);
+      const MeshLod &l = cyl.lods[item.lod];
+      cylinderTriangles += (caps ? l.indexCount : l.sideCount) / 3;
+    }
+  }
+  renderState.enable(GL_BLEND, false);
+  renderState.depthMask(true);
+  shader.setBool(u.useTexture, false);
+  shader.setBool(u.useEmissive, false);
+  shader.setVec2(u.uvScale, glm::vec2(1.0f, 1.0f));
 }
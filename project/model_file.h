@@ -0,0 +1,290 @@
+#ifndef MODEL_FILE_H
+#define MODEL_FILE_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Part hierarchy of a prop, read from a .model text file. One statement per
+// line, '#' starts a comment:
+//
+//   part NAME PARENT       start a part; PARENT is an earlier part, or '-'
+//     mesh NAME            drawn with this mesh (else just a transform)
+//     material NAME        texture/material, resolved by the renderer
+//     color R G B          object color, or emissive color (default white)
+//     uv U V               texture scale (default 1 1)
+//     translate X Y Z      local transform = translate * rotate * scale
+//     rotate DEG X Y Z
+//     scale X Y Z
+//     emissive             lit by itself, not by the scene lights
+//     additive             blended additively, drawn after opaque parts
+//     static               never moves: the renderer may bake it
+//     move CHANNEL X Y Z   animation: translate += channel * (X Y Z)
+//     spin CHANNEL X Y Z   animation: rotate by channel degrees about X Y Z
+//     stretch CHANNEL AXES animation: scale *= channel along AXES (e.g. xz)
+//     visible CHANNEL      hidden, with its children, while channel <= 0
+//
+// Channels are named floats set by the program each frame. Parts are kept
+// as parallel arrays in file order, which is topological since a parent
+// must come first, so evaluating the hierarchy is one forward sweep.
+enum PartFlag {
+  PART_EMISSIVE = 1 << 0,
+  PART_ADDITIVE = 1 << 1,
+  PART_STATIC = 1 << 2
+};
+
+enum TrackKind { TRACK_MOVE, TRACK_SPIN, TRACK_STRETCH };
+
+// One animated term of a part's local transform
+struct ModelTrack {
+  int channel;
+  TrackKind kind;
+  glm::vec3 vector; // offset, axis, or 1 on each stretched axis
+};
+
+class Model {
+public:
+  // Per part
+  std::vector<std::string> name;
+  std::vector<int> parent; // -1 for a root
+  std::vector<int> mesh;   // into meshNames, -1 for none
+  std::vector<int> material; // into materialNames, -1 for none
+  std::vector<glm::vec3> color;
+  std::vector<glm::vec2> uvScale;
+  std::vector<unsigned char> flags; // PartFlag
+  std::vector<glm::vec3> translation;
+  std::vector<glm::mat4> rotation;
+  std::vector<glm::vec3> scale;
+  std::vector<glm::mat4> restLocal; // local transform of a part with no tracks
+  std::vector<int> visibleChannel;  // -1 if always visible
+  std::vector<int> firstTrack;      // tracks of part i: [first[i], first[i+1])
+  std::vector<uint32_t> localChannels; // channels in the part's own tracks
+  std::vector<uint32_t> worldChannels; // ...and in its ancestors'
+
+  std::vector<ModelTrack> tracks;
+  std::vector<std::string> meshNames, materialNames, channelNames;
+
+  size_t size() const { return name.size(); }
+
+  // Parse path, replacing anything loaded before. Errors are printed with
+  // their line number.
+  bool load(const std::string &path) {
+    *this = Model();
+    std::ifstream file(path.c_str());
+    if (!file) {
+      std::cout << "Could not open model " << path << std::endl;
+      return false;
+    }
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+      lineNumber++;
+      size_t comment = line.find('#');
+      if (comment != std::string::npos)
+        line.erase(comment);
+      std::istringstream in(line);
+      std::string keyword;
+      if (!(in >> keyword))
+        continue;
+      std::string error = parseStatement(keyword, in);
+      if (error.empty()) {
+        std::string extra;
+        if (in >> extra)
+          error = "unexpected '" + extra + "'";
+      }
+      if (!error.empty()) {
+        std::cout << path << ":" << lineNumber << ": " << error << std::endl;
+        return false;
+      }
+    }
+    firstTrack.push_back((int)tracks.size());
+    for (size_t i = 0; i < size(); i++)
+      restLocal[i] = compose(translation[i], rotation[i], scale[i]);
+    return true;
+  }
+
+  int find(const std::string &partName) const {
+    return indexOf(name, partName);
+  }
+
+  int channel(const std::string &channelName) const {
+    return indexOf(channelNames, channelName);
+  }
+
+  bool visible(int part, const float *channels) const {
+    int c = visibleChannel[part];
+    return c < 0 || channels[c] > 0.0f;
+  }
+
+  glm::mat4 localTransform(int part, const float *channels) const {
+    if (localChannels[part] == 0)
+      return restLocal[part];
+    glm::vec3 t = translation[part];
+    glm::mat4 r = rotation[part];
+    glm::vec3 s = scale[part];
+    for (int k = firstTrack[part]; k < firstTrack[part + 1]; k++) {
+      const ModelTrack &track = tracks[k];
+      float value = channels[track.channel];
+      if (track.kind == TRACK_MOVE)
+        t += value * track.vector;
+      else if (track.kind == TRACK_SPIN)
+        r = glm::rotate(r, glm::radians(value), track.vector);
+      else
+        s *= track.vector * value + (glm::vec3(1.0f) - track.vector);
+    }
+    return compose(t, r, s);
+  }
+
+  // World matrix of every part, for the model placed at root
+  void evaluate(const glm::mat4 &root, const float *channels,
+                glm::mat4 *world) const {
+    for (size_t i = 0; i < size(); i++)
+      world[i] = (parent[i] < 0 ? root : world[parent[i]]) *
+                 localTransform((int)i, channels);
+  }
+
+  // Bring world, from an earlier evaluate at the same root, up to date
+  // after the channels in changed moved. Returns the parts recomputed.
+  int update(const glm::mat4 &root, const float *channels, uint32_t changed,
+             glm::mat4 *world) const {
+    int updated = 0;
+    for (size_t i = 0; i < size() && changed; i++) {
+      if (!(worldChannels[i] & changed))
+        continue;
+      world[i] = (parent[i] < 0 ? root : world[parent[i]]) *
+                 localTransform((int)i, channels);
+      updated++;
+    }
+    return updated;
+  }
+
+private:
+  static int indexOf(const std::vector<std::string> &names,
+                     const std::string &value) {
+    for (size_t i = 0; i < names.size(); i++)
+      if (names[i] == value)
+        return (int)i;
+    return -1;
+  }
+
+  static int intern(std::vector<std::string> &names,
+                    const std::string &value) {
+    int index = indexOf(names, value);
+    if (index >= 0)
+      return index;
+    names.push_back(value);
+    return (int)names.size() - 1;
+  }
+
+  static glm::mat4 compose(const glm::vec3 &t, const glm::mat4 &r,
+                           const glm::vec3 &s) {
+    glm::mat4 m = glm::translate(glm::mat4(1.0f), t) * r;
+    return glm::scale(m, s);
+  }
+
+  // Empty on success, else what is wrong with the statement
+  std::string parseStatement(const std::string &keyword, std::istream &in) {
+    if (keyword == "part")
+      return parsePart(in);
+    if (size() == 0)
+      return "'" + keyword + "' before the first part";
+    size_t i = size() - 1;
+    std::string word;
+    glm::vec3 v;
+    if (keyword == "mesh" || keyword == "material") {
+      if (!(in >> word))
+        return "missing name";
+      if (keyword == "mesh")
+        mesh[i] = intern(meshNames, word);
+      else
+        material[i] = intern(materialNames, word);
+    } else if (keyword == "color" || keyword == "translate" ||
+               keyword == "scale") {
+      if (!(in >> v.x >> v.y >> v.z))
+        return "expected three numbers";
+      (keyword == "color" ? color[i]
+                          : keyword == "translate" ? translation[i]
+                                                   : scale[i]) = v;
+    } else if (keyword == "uv") {
+      if (!(in >> uvScale[i].x >> uvScale[i].y))
+        return "expected two numbers";
+    } else if (keyword == "rotate") {
+      float degrees;
+      if (!(in >> degrees >> v.x >> v.y >> v.z))
+        return "expected an angle and an axis";
+      rotation[i] = glm::rotate(rotation[i], glm::radians(degrees), v);
+    } else if (keyword == "emissive") {
+      flags[i] |= PART_EMISSIVE;
+    } else if (keyword == "additive") {
+      flags[i] |= PART_ADDITIVE;
+    } else if (keyword == "static") {
+      flags[i] |= PART_STATIC;
+    } else if (keyword == "move" || keyword == "spin" ||
+               keyword == "stretch" || keyword == "visible") {
+      if (!(in >> word))
+        return "missing channel";
+      int c = intern(channelNames, word);
+      if (c >= 32)
+        return "more than 32 channels";
+      if (keyword == "visible") {
+        visibleChannel[i] = c;
+        return "";
+      }
+      ModelTrack track = {c, TRACK_MOVE, glm::vec3(0.0f)};
+      if (keyword == "stretch") {
+        track.kind = TRACK_STRETCH;
+        std::string axes;
+        if (!(in >> axes) || axes.find_first_not_of("xyz") != std::string::npos)
+          return "expected axes such as xz";
+        for (size_t a = 0; a < axes.size(); a++)
+          track.vector[axes[a] - 'x'] = 1.0f;
+      } else {
+        track.kind = keyword == "move" ? TRACK_MOVE : TRACK_SPIN;
+        if (!(in >> track.vector.x >> track.vector.y >> track.vector.z))
+          return "expected three numbers";
+      }
+      tracks.push_back(track);
+      localChannels[i] |= 1u << c;
+      worldChannels[i] |= 1u << c;
+    } else {
+      return "unknown statement '" + keyword + "'";
+    }
+    return "";
+  }
+
+  std::string parsePart(std::istream &in) {
+    std::string partName, parentName;
+    if (!(in >> partName >> parentName))
+      return "expected: part NAME PARENT";
+    if (find(partName) >= 0)
+      return "part '" + partName + "' defined twice";
+    int p = parentName == "-" ? -1 : find(parentName);
+    if (parentName != "-" && p < 0)
+      return "parent '" + parentName + "' must be defined first";
+    name.push_back(partName);
+    parent.push_back(p);
+    mesh.push_back(-1);
+    material.push_back(-1);
+    color.push_back(glm::vec3(1.0f));
+    uvScale.push_back(glm::vec2(1.0f));
+    flags.push_back(0);
+    translation.push_back(glm::vec3(0.0f));
+    rotation.push_back(glm::mat4(1.0f));
+    scale.push_back(glm::vec3(1.0f));
+    restLocal.push_back(glm::mat4(1.0f));
+    // children inherit their parent's visibility and animation
+    visibleChannel.push_back(p < 0 ? -1 : visibleChannel[p]);
+    firstTrack.push_back((int)tracks.size());
+    localChannels.push_back(0);
+    worldChannels.push_back(p < 0 ? 0 : worldChannels[p]);
+    return "";
+  }
+};
+
+#endif
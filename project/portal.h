@@ -0,0 +1,153 @@
+#ifndef PORTAL_H
+#define PORTAL_H
+
+#include "frustum.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <vector>
+
+// A box-shaped room of the level and the portals leading out of it
+struct PortalCell {
+  AABB bounds;
+  std::vector<int> portals;
+};
+
+// A convex opening (doorway) joining two cells
+struct Portal {
+  glm::vec3 corners[4];
+  int cells[2];
+};
+
+// Cells joined by portals, for finding what the camera can see. The walk
+// starts in the camera's cell with the whole screen. Each portal out of a
+// cell is projected to a screen rectangle and clipped to the rectangle the
+// cell was seen through. If anything is left, the cell behind the portal is
+// visible through it and the walk continues from there. A visible cell ends
+// up with the union of the rectangles it was seen through, kept as a
+// narrowed frustum.
+//
+// Cells past a run of narrowing doorways are never reached, so drawing and
+// lighting cost follows what is visible rather than how big the level is.
+// A camera outside every cell falls back to the plain view frustum.
+class CellGraph {
+public:
+  std::vector<PortalCell> cells;
+  std::vector<Portal> portals;
+
+  int addCell(const AABB &bounds) {
+    cells.push_back({bounds, {}});
+    return (int)cells.size() - 1;
+  }
+
+  // corners in winding order
+  void addPortal(int a, int b, glm::vec3 c0, glm::vec3 c1, glm::vec3 c2,
+                 glm::vec3 c3) {
+    portals.push_back({{c0, c1, c2, c3}, {a, b}});
+    cells[a].portals.push_back((int)portals.size() - 1);
+    cells[b].portals.push_back((int)portals.size() - 1);
+  }
+
+  // first cell containing p, or -1
+  int cellAt(const glm::vec3 &p) const {
+    for (size_t c = 0; c < cells.size(); c++)
+      if (overlaps(cells[c].bounds, {p, p}))
+        return (int)c;
+    return -1;
+  }
+
+  // Walk the portals from the cell holding eye
+  void findVisible(const glm::vec3 &eye, const glm::mat4 &viewProjection) {
+    visible.assign(cells.size(), 0);
+    rects.assign(cells.size(), glm::vec4(1.0f, 1.0f, -1.0f, -1.0f));
+    visibleCells.clear();
+    frustums.clear();
+    screen = Frustum(viewProjection);
+    int start = cellAt(eye);
+    inside = start >= 0;
+    if (!inside)
+      return;
+    std::vector<char> onPath(cells.size(), 0);
+    walk(start, glm::vec4(-1.0f, -1.0f, 1.0f, 1.0f), viewProjection, onPath);
+    for (size_t c = 0; c < cells.size(); c++) {
+      if (!visible[c])
+        continue;
+      visibleCells.push_back((int)c);
+      frustums.push_back(Frustum(viewProjection, rects[c]));
+    }
+  }
+
+  // whether box can be seen: it overlaps a visible cell and is inside that
+  // cell's narrowed frustum
+  bool intersects(const AABB &box) const {
+    if (!inside)
+      return screen.intersects(box);
+    for (size_t i = 0; i < visibleCells.size(); i++)
+      if (overlaps(box, cells[visibleCells[i]].bounds) &&
+          frustums[i].intersects(box))
+        return true;
+    return false;
+  }
+
+  int visibleCount() const {
+    return inside ? (int)visibleCells.size() : (int)cells.size();
+  }
+
+private:
+  bool inside = false;
+  Frustum screen = Frustum(glm::mat4(1.0f));
+  std::vector<char> visible;
+  std::vector<glm::vec4> rects; // x0, y0, x1, y1 in NDC
+  std::vector<int> visibleCells;
+  std::vector<Frustum> frustums; // one per visibleCells entry
+
+  void walk(int cell, const glm::vec4 &rect, const glm::mat4 &viewProjection,
+            std::vector<char> &onPath) {
+    visible[cell] = 1;
+    glm::vec4 &seen = rects[cell];
+    seen = glm::vec4(std::min(seen.x, rect.x), std::min(seen.y, rect.y),
+                     std::max(seen.z, rect.z), std::max(seen.w, rect.w));
+    onPath[cell] = 1;
+    for (int p : cells[cell].portals) {
+      const Portal &portal = portals[p];
+      int next = portal.cells[0] == cell ? portal.cells[1] : portal.cells[0];
+      glm::vec4 through;
+      if (onPath[next] || !project(portal, viewProjection, through))
+        continue;
+      through = glm::vec4(std::max(through.x, rect.x),
+                          std::max(through.y, rect.y),
+                          std::min(through.z, rect.z),
+                          std::min(through.w, rect.w));
+      if (through.x < through.z && through.y < through.w)
+        walk(next, through, viewProjection, onPath);
+    }
+    onPath[cell] = 0;
+  }
+
+  // Screen rectangle of a portal; false if it is entirely behind the camera.
+  // One that crosses the camera plane (the camera is in the doorway) is
+  // taken to cover the whole screen.
+  static bool project(const Portal &portal, const glm::mat4 &viewProjection,
+                      glm::vec4 &rect) {
+    rect = glm::vec4(1.0f, 1.0f, -1.0f, -1.0f);
+    int behind = 0;
+    for (const glm::vec3 &corner : portal.corners) {
+      glm::vec4 clip = viewProjection * glm::vec4(corner, 1.0f);
+      if (clip.w <= 1e-4f) {
+        behind++;
+        continue;
+      }
+      glm::vec2 ndc(clip.x / clip.w, clip.y / clip.w);
+      rect = glm::vec4(std::min(rect.x, ndc.x), std::min(rect.y, ndc.y),
+                       std::max(rect.z, ndc.x), std::max(rect.w, ndc.y));
+    }
+    if (behind == 4)
+      return false;
+    if (behind > 0)
+      rect = glm::vec4(-1.0f, -1.0f, 1.0f, 1.0f);
+    return true;
+  }
+};
+
+#endif
@@ -0,0 +1,113 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+enum BlendMode { BLEND_OPAQUE, BLEND_ADDITIVE };
+enum DrawMesh { MESH_CUBE, MESH_CYLINDER, MESH_CYLINDER_OPEN };
+
+// One draw submitted by the scene code. layer is the texture-array layer
+// (a Material) with color as the object color, or -1 for an untextured
+// emissive draw where color is the emissive color.
+struct DrawItem {
+  DrawMesh mesh;
+  int lod;
+  int layer;
+  glm::vec3 color;
+  glm::vec2 uvScale;
+  BlendMode blend;
+  glm::mat4 model;
+};
+
+// Draw items collected over a frame and put into an order that needs few
+// state changes. Each item gets a 64-bit key, and the keys are radix sorted:
+//
+//   opaque:   0 | material:8 | mesh+lod:8 | view depth:32 (front to back)
+//   additive: 1 | ~view depth:32 (back to front) | material:8 | mesh+lod:8
+//
+// Opaque draws come first, grouped by material and mesh and near to far
+// within a group, so early-Z rejects what they hide. Additive draws follow,
+// far to near.
+class RenderQueue {
+public:
+  std::vector<DrawItem> items;
+  // opaque items at the front of the last sort's order
+  size_t opaqueCount = 0;
+
+  void clear() { items.clear(); }
+  void submit(const DrawItem &item) { items.push_back(item); }
+
+  // Item indices in draw order for the camera at view
+  const std::vector<uint32_t> &sort(const glm::mat4 &view) {
+    keys.resize(items.size());
+    for (size_t i = 0; i < items.size(); i++)
+      keys[i] = {sortKey(items[i], view), (uint32_t)i};
+    radixSort();
+    order.resize(keys.size());
+    opaqueCount = 0;
+    for (size_t i = 0; i < keys.size(); i++) {
+      order[i] = keys[i].index;
+      if (items[order[i]].blend == BLEND_OPAQUE)
+        opaqueCount++;
+    }
+    return order;
+  }
+
+private:
+  struct Keyed {
+    uint64_t key;
+    uint32_t index;
+  };
+
+  std::vector<Keyed> keys, scratch;
+  std::vector<uint32_t> order;
+
+  // non-negative floats order the same as their bit patterns
+  static uint32_t depthBits(float depth) {
+    depth = std::max(depth, 0.0f);
+    uint32_t bits;
+    std::memcpy(&bits, &depth, sizeof(bits));
+    return bits;
+  }
+
+  static uint64_t sortKey(const DrawItem &item, const glm::mat4 &view) {
+    float depth = -(view * item.model[3]).z;
+    uint64_t material = (uint64_t)(item.layer + 1) & 0xff;
+    uint64_t mesh = (uint64_t)(item.mesh * 4 + item.lod) & 0xff;
+    if (item.blend == BLEND_OPAQUE)
+      return material << 48 | mesh << 40 | depthBits(depth);
+    return (uint64_t)1 << 63 | (uint64_t)(~depthBits(depth)) << 16 |
+           material << 8 | mesh;
+  }
+
+  // LSD radix sort, a byte per pass. A pass where every key has the same
+  // byte would not move anything and is skipped.
+  void radixSort() {
+    if (keys.empty())
+      return;
+    scratch.resize(keys.size());
+    for (int shift = 0; shift < 64; shift += 8) {
+      size_t offsets[256] = {0};
+      for (const Keyed &k : keys)
+        offsets[(k.key >> shift) & 0xff]++;
+      if (offsets[(keys[0].key >> shift) & 0xff] == keys.size())
+        continue;
+      size_t total = 0;
+      for (size_t &offset : offsets) {
+        size_t count = offset;
+        offset = total;
+        total += count;
+      }
+      for (const Keyed &k : keys)
+        scratch[offsets[(k.key >> shift) & 0xff]++] = k;
+      keys.swap(scratch);
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef RENDER_STATE_H
+#define RENDER_STATE_H
+
+#include <GL/glew.h>
+
+// Shadow copy of the GL pipeline state the scene code changes. Every setter
+// compares against the last value it sent and only calls GL when the value
+// differs, so turning on blending for each of the lanterns costs one call,
+// not eight. All changes to the tracked state have to go through here;
+// anything that bypasses it leaves the shadow copy stale.
+class RenderState {
+public:
+  void enable(GLenum capability, bool on) {
+    int *state = capabilityState(capability);
+    if (state && *state == (int)on) {
+      skipped++;
+      return;
+    }
+    if (state)
+      *state = on;
+    issued++;
+    if (on)
+      glEnable(capability);
+    else
+      glDisable(capability);
+  }
+
+  void blendFunc(GLenum src, GLenum dst) {
+    if (blendSrc == src && blendDst == dst) {
+      skipped++;
+      return;
+    }
+    blendSrc = src;
+    blendDst = dst;
+    issued++;
+    glBlendFunc(src, dst);
+  }
+
+  void depthMask(bool on) {
+    if (depthWrite == (int)on) {
+      skipped++;
+      return;
+    }
+    depthWrite = on;
+    issued++;
+    glDepthMask(on ? GL_TRUE : GL_FALSE);
+  }
+
+  void depthFunc(GLenum func) {
+    if (depthTestFunc == func) {
+      skipped++;
+      return;
+    }
+    depthTestFunc = func;
+    issued++;
+    glDepthFunc(func);
+  }
+
+  void useProgram(unsigned int program) {
+    if (currentProgram == program) {
+      skipped++;
+      return;
+    }
+    currentProgram = program;
+    issued++;
+    glUseProgram(program);
+  }
+
+  // adds the GL calls made and skipped since the last call to the arguments
+  // and starts a new count
+  void takeCalls(unsigned int &issuedOut, unsigned int &skippedOut) {
+    issuedOut += issued;
+    skippedOut += skipped;
+    issued = skipped = 0;
+  }
+
+private:
+  // -1 until first set: GL's defaults are not assumed
+  int blend = -1, depthTest = -1, cullFace = -1, depthWrite = -1;
+  GLenum blendSrc = GL_NONE, blendDst = GL_NONE, depthTestFunc = GL_NONE;
+  unsigned int currentProgram = 0;
+  unsigned int issued = 0, skipped = 0;
+
+  int *capabilityState(GLenum capability) {
+    switch (capability) {
+    case GL_BLEND:
+      return &blend;
+    case GL_DEPTH_TEST:
+      return &depthTest;
+    case GL_CULL_FACE:
+      return &cullFace;
+    default:
+      return nullptr; // untracked, always sent
+    }
+  }
+};
+
+#endif
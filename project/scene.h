@@ -0,0 +1,297 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "frustum.h"
+#include "geometry.h"
+
+#include <algorithm>
+#include <cmath>
+#include <glm/glm.hpp>
+#include <vector>
+
+// Material IDs for baked geometry, one per tomb texture. A material's ID is
+// also its layer in the tomb texture array.
+enum Material {
+  MATERIAL_FLOOR,
+  MATERIAL_PILLAR,
+  MATERIAL_WALL,
+  MATERIAL_LANTERN,
+  MATERIAL_GRAVEYARD,
+  MATERIAL_COUNT
+};
+
+// All static pieces of one material and colour pre-transformed into a
+// single interleaved vertex/index buffer, in the Cube vertex layout, so they
+// are one glDrawElements with an identity model matrix. Pieces are stored
+// cell by cell; cellFirst/cellCount are each cell's index range.
+struct MergedMesh {
+  unsigned int VAO = 0, VBO = 0, EBO = 0;
+  int indexCount = 0;
+  int material = 0;
+  glm::vec3 color;
+  std::vector<int> cellFirst, cellCount;
+
+  void draw() const {
+    if (indexCount == 0)
+      return;
+    glBindVertexArray(VAO);
+    glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
+    glBindVertexArray(0);
+  }
+
+  // only the cells marked visible, adjacent ones joined into one draw
+  void draw(const std::vector<char> &cellVisible) const {
+    if (indexCount == 0)
+      return;
+    glBindVertexArray(VAO);
+    int first = 0, count = 0;
+    for (size_t c = 0; c <= cellVisible.size(); c++) {
+      bool visible = c < cellVisible.size() && cellVisible[c];
+      if (visible && count > 0 && cellFirst[c] == first + count) {
+        count += cellCount[c];
+        continue;
+      }
+      if (count > 0)
+        glDrawElements(GL_TRIANGLES, count, GL_UNSIGNED_INT,
+                       (void *)(first * sizeof(unsigned int)));
+      first = visible ? cellFirst[c] : 0;
+      count = visible ? cellCount[c] : 0;
+    }
+    glBindVertexArray(0);
+  }
+};
+
+// A group of static pieces culled together: one grid cell, or one piece too
+// big for a cell. Its pieces are the instance range [first, first + count).
+struct StaticCell {
+  AABB bounds;
+  int first, count;
+};
+
+// Everything in the tomb that never moves, baked once at startup into a flat
+// array of cube transforms (with uvScale and color) and material IDs, kept
+// in one persistent instance buffer.
+//
+// For culling, pieces are binned into a grid of cellSize squares on the XZ
+// plane by the centre of their bounds; a piece wider than a cell gets a
+// cell of its own. The array is sorted by cell, then material, so each cell
+// is a contiguous instance range and a run of visible cells is one draw.
+class StaticScene {
+public:
+  CubeInstanceBatch batch;
+  std::vector<int> materials; // material of each instance in batch
+  std::vector<StaticCell> cells;
+  // one per (material, colour) pair, by material
+  std::vector<MergedMesh> merged;
+
+  // filled by cull(): visibility of each cell, the visible instance ranges
+  // with adjacent cells joined (bounds included), how many instances they
+  // hold and the bounds of them all
+  std::vector<char> cellVisible;
+  std::vector<StaticCell> visibleRanges;
+  int visibleInstances = 0;
+  AABB visibleBounds = AABB();
+
+  StaticScene(const Cube &cube, float cellSize = 5.0f)
+      : batch(cube), cellSize(cellSize), cube(cube) {}
+
+  void add(int material, const glm::mat4 &model, glm::vec2 uvScale,
+           glm::vec3 color) {
+    pending.push_back({{model, uvScale, color, (float)material}, material,
+                       cubeBounds(model), 0});
+  }
+
+  // bin into cells, sort by cell and material, record each cell's range and
+  // upload the lot
+  void build() {
+    assignCells();
+    std::stable_sort(pending.begin(), pending.end(),
+                     [](const Item &a, const Item &b) {
+                       if (a.cell != b.cell)
+                         return a.cell < b.cell;
+                       return a.material < b.material;
+                     });
+    batch.instances.clear();
+    materials.clear();
+    for (const Item &item : pending) {
+      StaticCell &cell = cells[item.cell];
+      if (cell.count == 0) {
+        cell.first = (int)batch.instances.size();
+        cell.bounds = item.bounds;
+      }
+      cell.bounds.expand(item.bounds);
+      cell.count++;
+      batch.instances.push_back(item.instance);
+      materials.push_back(item.material);
+    }
+    pending.clear();
+    batch.upload();
+    bakeMerged();
+    cellVisible.assign(cells.size(), 1);
+    AABB all = cells.empty() ? AABB() : cells[0].bounds;
+    for (const StaticCell &cell : cells)
+      all.expand(cell.bounds);
+    visibleRanges.assign(1, {all, 0, size()});
+    visibleBounds = all;
+    visibleInstances = size();
+  }
+
+  // test every cell against volume, anything with
+  // bool intersects(const AABB &) const (a Frustum or a CellGraph)
+  template <typename Volume> void cull(const Volume &volume) {
+    visibleRanges.clear();
+    visibleInstances = 0;
+    for (size_t c = 0; c < cells.size(); c++) {
+      const StaticCell &cell = cells[c];
+      cellVisible[c] = volume.intersects(cell.bounds);
+      if (!cellVisible[c])
+        continue;
+      visibleInstances += cell.count;
+      if (visibleRanges.empty())
+        visibleBounds = cell.bounds;
+      visibleBounds.expand(cell.bounds);
+      if (!visibleRanges.empty() &&
+          visibleRanges.back().first + visibleRanges.back().count ==
+              cell.first) {
+        visibleRanges.back().count += cell.count;
+        visibleRanges.back().bounds.expand(cell.bounds);
+      } else {
+        visibleRanges.push_back({cell.bounds, cell.first, cell.count});
+      }
+    }
+  }
+
+  int size() const { return (int)materials.size(); }
+
+private:
+  float cellSize;
+  const Cube &cube;
+
+  // cell index of every pending piece; grid cells are numbered by (z, x),
+  // then each oversized piece gets the next index
+  void assignCells() {
+    struct Key {
+      int x, z;
+      bool operator<(const Key &o) const {
+        return z != o.z ? z < o.z : x < o.x;
+      }
+      bool operator==(const Key &o) const { return x == o.x && z == o.z; }
+    };
+    std::vector<Key> keys(pending.size()), grid;
+    std::vector<bool> oversized(pending.size());
+    for (size_t i = 0; i < pending.size(); i++) {
+      const AABB &b = pending[i].bounds;
+      glm::vec3 size = b.max - b.min;
+      oversized[i] = size.x > cellSize || size.z > cellSize;
+      if (oversized[i])
+        continue;
+      glm::vec3 center = 0.5f * (b.min + b.max);
+      keys[i] = {(int)std::floor(center.x / cellSize),
+                 (int)std::floor(center.z / cellSize)};
+      grid.push_back(keys[i]);
+    }
+    std::sort(grid.begin(), grid.end());
+    grid.erase(std::unique(grid.begin(), grid.end()), grid.end());
+    int next = (int)grid.size();
+    for (size_t i = 0; i < pending.size(); i++)
+      pending[i].cell =
+          oversized[i] ? next++
+                       : (int)(std::lower_bound(grid.begin(), grid.end(),
+                                                keys[i]) -
+                               grid.begin());
+    cells.assign(next, {AABB(), 0, 0});
+  }
+
+  // One merged mesh for each distinct colour of each material, so every
+  // piece keeps its own colour as on the other paths (the floor and the
+  // ceiling share a texture but not a colour)
+  void bakeMerged() {
+    merged.clear();
+    for (int m = 0; m < MATERIAL_COUNT; m++) {
+      std::vector<glm::vec3> colors;
+      for (int i = 0; i < size(); i++) {
+        const glm::vec3 &color = batch.instances[i].color;
+        if (materials[i] == m &&
+            std::find(colors.begin(), colors.end(), color) == colors.end())
+          colors.push_back(color);
+      }
+      for (const glm::vec3 &color : colors) {
+        merged.push_back(MergedMesh());
+        bakeMerged(merged.back(), m, color);
+      }
+    }
+  }
+
+  // Pre-transform every piece of material m and this colour: positions by
+  // the model matrix, normals and tangents by its normal matrix (as
+  // vshader.glsl does) and texcoords by the piece's uvScale, which the
+  // merged draw then leaves at 1.
+  void bakeMerged(MergedMesh &mesh, int m, const glm::vec3 &color) {
+    std::vector<float> vertices;
+    std::vector<unsigned int> indices;
+    mesh.material = m;
+    mesh.color = color;
+    mesh.cellFirst.assign(cells.size(), 0);
+    mesh.cellCount.assign(cells.size(), 0);
+    for (size_t c = 0; c < cells.size(); c++) {
+      mesh.cellFirst[c] = (int)indices.size();
+      for (int i = cells[c].first; i < cells[c].first + cells[c].count; i++)
+        if (materials[i] == m && batch.instances[i].color == color)
+          appendPiece(batch.instances[i], vertices, indices);
+      mesh.cellCount[c] = (int)indices.size() - mesh.cellFirst[c];
+    }
+
+    mesh.indexCount = (int)indices.size();
+    if (mesh.indexCount == 0)
+      return;
+    glGenVertexArrays(1, &mesh.VAO);
+    glGenBuffers(1, &mesh.VBO);
+    glGenBuffers(1, &mesh.EBO);
+    glBindVertexArray(mesh.VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh.VBO);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float),
+                 vertices.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.EBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int),
+                 indices.data(), GL_STATIC_DRAW);
+    Cube::setVertexAttributes();
+    glBindVertexArray(0);
+  }
+
+  void appendPiece(const CubeInstance &piece, std::vector<float> &vertices,
+                   std::vector<unsigned int> &indices) const {
+    const int stride = 11;
+    const std::vector<float> &src = cube.vertexData;
+    int verticesPerPiece = (int)src.size() / stride;
+    glm::mat3 normalMatrix =
+        glm::transpose(glm::inverse(glm::mat3(piece.model)));
+    unsigned int base = (unsigned int)(vertices.size() / stride);
+    for (unsigned short index : cube.indices)
+      indices.push_back(base + index);
+    for (int v = 0; v < verticesPerPiece; v++) {
+      const float *in = &src[v * stride];
+      glm::vec3 pos =
+          glm::vec3(piece.model * glm::vec4(in[0], in[1], in[2], 1.0f));
+      glm::vec3 normal =
+          glm::normalize(normalMatrix * glm::vec3(in[3], in[4], in[5]));
+      glm::vec3 tangent =
+          glm::normalize(normalMatrix * glm::vec3(in[8], in[9], in[10]));
+      float out[11] = {
+          pos.x,     pos.y,     pos.z,                    // position
+          normal.x,  normal.y,  normal.z,                 // normal
+          in[6] * piece.uvScale.x, in[7] * piece.uvScale.y, // texcoord
+          tangent.x, tangent.y, tangent.z};               // tangent
+      vertices.insert(vertices.end(), out, out + stride);
+    }
+  }
+
+  struct Item {
+    CubeInstance instance;
+    int material;
+    AABB bounds;
+    int cell;
+  };
+  std::vector<Item> pending;
+};
+
+#endif
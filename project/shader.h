@@ -5,14 +5,30 @@
 #include <GL/glew.h>
 #include <glm/glm.hpp>
 
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <unordered_map>
+#include <vector>
+
+// Handle to a uniform location resolved once after link. Hot-path callers
+// keep these around instead of passing names, so setting a uniform is a
+// single glUniform* call with no string hashing or driver lookup.
+struct Uniform {
+  int location = -1;
+};
 
 class Shader {
 public:
   unsigned int ID;
+  // number of uniform writes since the last takeLookupsSaved() that would
+  // have been a glGetUniformLocation call without the location cache
+  mutable unsigned int lookupsSaved = 0;
+  // glUniform* calls made, and skipped because the uniform already held the
+  // value, since the last takeUniformWrites()
+  mutable unsigned int uniformWrites = 0, uniformWritesSkipped = 0;
 
   // constructor generates the shader on the fly
   // ------------------------------------------------------------------------
@@ -67,44 +83,166 @@ public:
     // necessary
     glDeleteShader(vertex);
     glDeleteShader(fragment);
+    cacheUniformLocations();
   }
   // activate the shader
   // ------------------------------------------------------------------------
   void use() { glUseProgram(ID); }
-  // utility uniform functions
+  // resolve a uniform name to a cached handle (location -1 if the uniform is
+  // not active, which glUniform* silently ignores like the old lookup did)
+  // ------------------------------------------------------------------------
+  Uniform uniform(const std::string &name) const {
+    Uniform u;
+    auto it = uniformLocations.find(name);
+    if (it != uniformLocations.end())
+      u.location = it->second;
+    return u;
+  }
+  // returns the saved-lookup counter and starts a new count (once per frame)
+  unsigned int takeLookupsSaved() {
+    unsigned int n = lookupsSaved;
+    lookupsSaved = 0;
+    return n;
+  }
+  // adds the uniform writes made and skipped to the arguments and starts a
+  // new count
+  void takeUniformWrites(unsigned int &written, unsigned int &skipped) {
+    written += uniformWrites;
+    skipped += uniformWritesSkipped;
+    uniformWrites = uniformWritesSkipped = 0;
+  }
+  // utility uniform functions; each skips the GL call when the uniform
+  // already holds the value
   // ------------------------------------------------------------------------
   void setBool(const std::string &name, bool value) const {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+    setBool(uniform(name), value);
+  }
+  void setBool(Uniform u, bool value) const {
+    setInt(u, (int)value);
   }
   // ------------------------------------------------------------------------
   void setInt(const std::string &name, int value) const {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+    setInt(uniform(name), value);
+  }
+  void setInt(Uniform u, int value) const {
+    lookupsSaved++;
+    if (changed(u.location, &value, sizeof(value)))
+      glUniform1i(u.location, value);
   }
   // ------------------------------------------------------------------------
   void setFloat(const std::string &name, float value) const {
-    glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+    setFloat(uniform(name), value);
+  }
+  void setFloat(Uniform u, float value) const {
+    lookupsSaved++;
+    if (changed(u.location, &value, sizeof(value)))
+      glUniform1f(u.location, value);
   }
   // ------------------------------------------------------------------------
   void setVec3(const std::string &name, const glm::vec3 &value) const {
-    glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+    setVec3(uniform(name), value);
   }
   void setVec3(const std::string &name, float x, float y, float z) const {
-    glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+    setVec3(uniform(name), x, y, z);
+  }
+  void setVec3(Uniform u, const glm::vec3 &value) const {
+    lookupsSaved++;
+    if (changed(u.location, &value[0], sizeof(value)))
+      glUniform3fv(u.location, 1, &value[0]);
+  }
+  void setVec3(Uniform u, float x, float y, float z) const {
+    setVec3(u, glm::vec3(x, y, z));
   }
   // ------------------------------------------------------------------------
   void setVec2(const std::string &name, const glm::vec2 &value) const {
-    glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+    setVec2(uniform(name), value);
   }
   void setVec2(const std::string &name, float x, float y) const {
-    glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+    setVec2(uniform(name), x, y);
+  }
+  void setVec2(Uniform u, const glm::vec2 &value) const {
+    lookupsSaved++;
+    if (changed(u.location, &value[0], sizeof(value)))
+      glUniform2fv(u.location, 1, &value[0]);
+  }
+  void setVec2(Uniform u, float x, float y) const {
+    setVec2(u, glm::vec2(x, y));
   }
   // ------------------------------------------------------------------------
   void setMat4(const std::string &name, const glm::mat4 &mat) const {
-    glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE,
-                       &mat[0][0]);
+    setMat4(uniform(name), mat);
+  }
+  void setMat4(Uniform u, const glm::mat4 &mat) const {
+    lookupsSaved++;
+    if (changed(u.location, &mat[0][0], sizeof(mat)))
+      glUniformMatrix4fv(u.location, 1, GL_FALSE, &mat[0][0]);
   }
 
 private:
+  // last value written to a uniform location, as raw bytes (a mat4 at most)
+  struct UniformValue {
+    size_t size = 0;
+    unsigned char bytes[64];
+  };
+
+  std::unordered_map<std::string, int> uniformLocations;
+  mutable std::vector<UniformValue> uniformValues; // indexed by location
+
+  // true, remembering the value, if the uniform at location doesn't hold it
+  // yet. Inactive uniforms (location -1) never need the call.
+  bool changed(int location, const void *value, size_t size) const {
+    if (location < 0) {
+      uniformWritesSkipped++;
+      return false;
+    }
+    if (location < (int)uniformValues.size()) {
+      UniformValue &cached = uniformValues[location];
+      if (cached.size == size && std::memcmp(cached.bytes, value, size) == 0) {
+        uniformWritesSkipped++;
+        return false;
+      }
+      cached.size = size;
+      std::memcpy(cached.bytes, value, size);
+    }
+    uniformWrites++;
+    return true;
+  }
+
+  // query every active uniform once after link. Arrays of basic types are
+  // reported as "name[0]" with a size, so the bare name and every element
+  // get their own entry; struct arrays already come back one member each.
+  // ------------------------------------------------------------------------
+  void cacheUniformLocations() {
+    int count = 0, maxLength = 0;
+    glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+    std::string nameBuffer(maxLength > 0 ? maxLength : 1, '\0');
+    for (int i = 0; i < count; i++) {
+      int length = 0, size = 0;
+      GLenum type;
+      glGetActiveUniform(ID, i, maxLength, &length, &size, &type,
+                         &nameBuffer[0]);
+      std::string name(nameBuffer.c_str(), length);
+      int location = glGetUniformLocation(ID, name.c_str());
+      if (location < 0)
+        continue; // uniform block member, set through its buffer instead
+      uniformLocations[name] = location;
+      if (location >= (int)uniformValues.size())
+        uniformValues.resize(location + size);
+      if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0) {
+        std::string base = name.substr(0, name.size() - 3);
+        uniformLocations[base] = location;
+        for (int e = 1; e < size; e++) {
+          std::string element = base + "[" + std::to_string(e) + "]";
+          int elementLocation = glGetUniformLocation(ID, element.c_str());
+          uniformLocations[element] = elementLocation;
+          if (elementLocation >= (int)uniformValues.size())
+            uniformValues.resize(elementLocation + 1);
+        }
+      }
+    }
+  }
+
   // utility function for checking shader compilation/linking errors.
   // ------------------------------------------------------------------------
   void checkCompileErrors(unsigned int shader, std::string type) {
@@ -4,21 +4,47 @@ layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
 layout (location = 3) in vec3 aTangent;
 
+// Per-instance data for Cube::drawInstanced (see CubeInstance)
+layout (location = 4) in mat4 aInstanceModel;
+layout (location = 8) in vec2 aInstanceUVScale;
+layout (location = 9) in vec3 aInstanceColor;
+layout (location = 10) in float aInstanceLayer;
+
 out vec3 FragPos;
 out vec2 TexCoords;
 out vec3 Normal;
 out mat3 TBN;
+out vec2 UVScale;
+out vec3 ObjectColor;
+flat out float Layer;
+out float ViewDepth; // for picking the light cluster
 
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
+uniform bool useInstancing;
+uniform vec2 uvScale;
+uniform vec3 objectColor;
+uniform float textureLayer;
+
 void main()
 {
-    FragPos = vec3(model * vec4(aPos, 1.0));
+    mat4 M = model;
+    UVScale = uvScale;
+    ObjectColor = objectColor;
+    Layer = textureLayer;
+    if (useInstancing) {
+        M = aInstanceModel;
+        UVScale = aInstanceUVScale;
+        ObjectColor = aInstanceColor;
+        Layer = aInstanceLayer;
+    }
+
+    FragPos = vec3(M * vec4(aPos, 1.0));
     TexCoords = aTexCoords;
     
-    mat3 normalMatrix = transpose(inverse(mat3(model)));
+    mat3 normalMatrix = transpose(inverse(mat3(M)));
     Normal = normalMatrix * aNormal;
     
     vec3 T = normalize(normalMatrix * aTangent);
@@ -28,7 +54,9 @@ void main()
     
     TBN = mat3(T, B, N);
     
-    gl_Position = projection * view * vec4(FragPos, 1.0);
+    vec4 viewPos = view * vec4(FragPos, 1.0);
+    ViewDepth = -viewPos.z;
+    gl_Position = projection * viewPos;
 }
 
 // <!-- split -->
@@ -36,16 +64,18 @@ void main()
 #version 330 core
 out vec4 FragColor;
 
+// Field order packs each float into the padding after a vec3, so the std140
+// layout matches PointLightStd140 in light_buffer.h (64 bytes per light).
+// The clustered path reads the same 64 bytes as four texels.
 struct PointLight {
     vec3 position;
-    
     float constant;
-    float linear;
-    float quadratic;
-    
     vec3 ambient;
+    float linear;
     vec3 diffuse;
+    float quadratic;
     vec3 specular;
+    float range;
 };
 
 struct SpotLight {
@@ -67,50 +97,96 @@ in vec3 FragPos;
 in vec2 TexCoords;
 in vec3 Normal;
 in mat3 TBN;
+in vec2 UVScale;
+in vec3 ObjectColor;
+flat in float Layer;
+in float ViewDepth;
+
+#define MAX_POINT_LIGHTS 16
+
+// Lantern lights, written by LightBuffer in one glBufferSubData per frame
+layout (std140) uniform LightBlock {
+    int numPointLights;
+    PointLight pointLights[MAX_POINT_LIGHTS];
+};
+
+// Clustered lights, written by LightClusters; CLUSTER_X/Y/Z must match
+// light_clusters.h. clusterLights holds four texels per light; clusterData
+// holds an (offset, count) pair per cluster followed by the light indices.
+#define CLUSTER_X 16
+#define CLUSTER_Y 12
+#define CLUSTER_Z 24
+uniform bool useClusters;
+uniform int numClusteredLights;
+uniform samplerBuffer clusterLights;
+uniform usamplerBuffer clusterData;
+uniform vec2 clusterScale; // tiles per pixel
+uniform vec2 clusterDepth; // slice = log(depth) * x + y
+
+// Bit i set if pointLights[i] reaches the current draw (set per draw from
+// the CPU's light culling); unused by the clustered path
+uniform int drawLightMask;
 
-uniform int numPointLights;
-uniform PointLight pointLights[10]; // Max 10 lights
 uniform SpotLight spotLight;
 uniform bool spotLightOn;
 
 uniform vec3 viewPos;
-uniform vec3 objectColor;
 uniform bool useTexture;
-uniform sampler2D texture1;
+// Tomb materials, one layer each (see TextureArray)
+uniform sampler2DArray textureLayers;
 uniform sampler2D normalMap;
 uniform bool useNormalMap;
 
+// Emissive support for self-lit objects (lantern flames)
+uniform bool useEmissive;
+uniform vec3 emissiveColor;
+
 vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 color);
+vec3 CalcClusteredLights(vec3 normal, vec3 fragPos, vec3 viewDir, vec3 color);
 vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 color);
 
 void main()
 {
+    // Emissive objects bypass lighting entirely
+    if (useEmissive) {
+        FragColor = vec4(emissiveColor, 1.0);
+        return;
+    }
+
     vec3 norm = normalize(Normal);
+    vec2 scaledTexCoords = TexCoords * UVScale;
     if (useNormalMap) {
-        norm = texture(normalMap, TexCoords).rgb;
+        norm = texture(normalMap, scaledTexCoords).rgb;
         norm = norm * 2.0 - 1.0;   
         norm = normalize(TBN * norm);
     }
     
     vec3 viewDir = normalize(viewPos - FragPos);
     
-    vec3 baseColor = objectColor;
+    vec3 baseColor = ObjectColor;
     if (useTexture) {
-        baseColor = texture(texture1, TexCoords).rgb;
+        baseColor = texture(textureLayers, vec3(scaledTexCoords, Layer)).rgb;
     }
     
     vec3 result = vec3(0.0);
     
     // Point Lights
-    for(int i = 0; i < numPointLights; i++)
-        result += CalcPointLight(pointLights[i], norm, FragPos, viewDir, baseColor);
+    int lightTotal = numPointLights;
+    if (useClusters) {
+        result += CalcClusteredLights(norm, FragPos, viewDir, baseColor);
+        lightTotal = numClusteredLights;
+    } else {
+        for(int i = 0; i < numPointLights; i++)
+            if ((drawLightMask & (1 << i)) != 0)
+                result += CalcPointLight(pointLights[i], norm, FragPos, viewDir, baseColor);
+    }
         
     // Spot Light (Flashlight/Headlight)
     if (spotLightOn)
         result += CalcSpotLight(spotLight, norm, FragPos, viewDir, baseColor);
      
     // Ambient fallback if no lights
-    if (numPointLights == 0 && !spotLightOn)
+    if (lightTotal == 0 && !spotLightOn)
         result = baseColor * 0.1;
         
     FragColor = vec4(result, 1.0);
@@ -143,6 +219,33 @@ vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, v
     return (ambient + diffuse + specular);
 }
 
+// Only the lights binned into this fragment's cluster, and of those only the
+// ones whose range reaches it, so the cut-off is a sphere, not a froxel
+vec3 CalcClusteredLights(vec3 normal, vec3 fragPos, vec3 viewDir, vec3 color)
+{
+    ivec2 tile = ivec2(gl_FragCoord.xy * clusterScale);
+    tile = clamp(tile, ivec2(0), ivec2(CLUSTER_X - 1, CLUSTER_Y - 1));
+    int slice = int(floor(log(max(ViewDepth, 1e-4)) * clusterDepth.x + clusterDepth.y));
+    slice = clamp(slice, 0, CLUSTER_Z - 1);
+    int cluster = (slice * CLUSTER_Y + tile.y) * CLUSTER_X + tile.x;
+
+    int offset = int(texelFetch(clusterData, cluster * 2).r);
+    int count = int(texelFetch(clusterData, cluster * 2 + 1).r);
+    vec3 result = vec3(0.0);
+    for (int i = 0; i < count; i++) {
+        int base = int(texelFetch(clusterData, offset + i).r) * 4;
+        vec4 t0 = texelFetch(clusterLights, base);
+        vec4 t1 = texelFetch(clusterLights, base + 1);
+        vec4 t2 = texelFetch(clusterLights, base + 2);
+        vec4 t3 = texelFetch(clusterLights, base + 3);
+        PointLight light = PointLight(t0.xyz, t0.w, t1.xyz, t1.w, t2.xyz, t2.w,
+                                      t3.xyz, t3.w);
+        if (length(light.position - fragPos) < light.range)
+            result += CalcPointLight(light, normal, fragPos, viewDir, color);
+    }
+    return result;
+}
+
 vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 color)
 {
     vec3 lightDir = normalize(light.position - fragPos);
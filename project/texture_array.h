@@ -0,0 +1,209 @@
+#ifndef TEXTURE_ARRAY_H
+#define TEXTURE_ARRAY_H
+
+#include <GL/glew.h>
+
+#include "stb_image.h"
+#include "texture_cache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Several same-sized RGB images as the layers of one GL_TEXTURE_2D_ARRAY, so
+// a draw can switch material by layer index instead of by texture binding.
+// The size comes from the first readable image header; images of another
+// size are reported and keep the placeholder.
+//
+// With async set, decoding runs on a small thread pool and the constructor
+// returns straight away with every layer showing a grey placeholder. poll(),
+// called on the GL thread once per frame, uploads each layer through a pixel
+// buffer object as its decode finishes.
+//
+// With a cachePath, a valid TextureCache file replaces all of the above. Once
+// every layer has been decoded the cache is (re)written, BC1-compressed if
+// compressCache is set, for the next start.
+class TextureArray {
+public:
+  unsigned int ID;
+  int width = 0, height = 0, layers = 0;
+
+  TextureArray(const std::vector<std::string> &paths, bool async = false,
+               const std::string &cachePath = "", bool compressCache = false)
+      : layers((int)paths.size()), paths(paths), cachePath(cachePath),
+        compressCache(compressCache), pending((int)paths.size()) {
+    glGenTextures(1, &ID);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, ID);
+    setParameters();
+    if (!cachePath.empty() &&
+        TextureCache::load(cachePath, paths, compressCache, width, height)) {
+      pending = 0;
+      return;
+    }
+
+    for (const std::string &path : paths) {
+      int nrComponents;
+      if (stbi_info(path.c_str(), &width, &height, &nrComponents))
+        break;
+    }
+    if (width == 0)
+      width = height = 1;
+
+    glGenBuffers(1, &PBO);
+    allocate();
+
+    if (async) {
+      int threads = std::max(
+          1, std::min((int)std::thread::hardware_concurrency(), layers));
+      for (int i = 0; i < threads; i++)
+        workers.emplace_back(&TextureArray::decodeWorker, this);
+    } else {
+      decodeWorker();
+      poll();
+    }
+  }
+
+  ~TextureArray() {
+    joinWorkers();
+    for (Decoded &d : decoded)
+      stbi_image_free(d.data);
+  }
+
+  TextureArray(const TextureArray &) = delete;
+  TextureArray &operator=(const TextureArray &) = delete;
+
+  // Upload every layer decoded since the last call, then rebuild the mip
+  // chain once. Returns true once all layers have arrived.
+  bool poll() {
+    if (pending == 0)
+      return true;
+    std::deque<Decoded> ready;
+    {
+      std::lock_guard<std::mutex> lock(decodedMutex);
+      ready.swap(decoded);
+    }
+    if (ready.empty())
+      return false;
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY, ID);
+    for (Decoded &d : ready) {
+      if (!upload(d))
+        failed++;
+      stbi_image_free(d.data);
+      pending--;
+    }
+    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    if (pending == 0) {
+      joinWorkers();
+      glDeleteBuffers(1, &PBO);
+      PBO = 0;
+      if (!cachePath.empty() && failed == 0)
+        TextureCache::write(cachePath, paths, width, height, compressCache);
+    }
+    return pending == 0;
+  }
+
+  bool ready() const { return pending == 0; }
+
+  void bind(unsigned int unit) const {
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, ID);
+  }
+
+private:
+  struct Decoded {
+    int layer;
+    int width, height;
+    unsigned char *data; // RGB, or nullptr if the load failed
+  };
+
+  std::vector<std::string> paths;
+  std::string cachePath;
+  bool compressCache;
+  unsigned int PBO = 0;
+  int pending;    // layers not yet uploaded (or given up on)
+  int failed = 0; // layers left on the placeholder
+  std::atomic<int> nextLayer{0};
+  std::vector<std::thread> workers;
+  std::mutex decodedMutex;
+  std::deque<Decoded> decoded;
+
+  // Claim layers until none are left. stb_image keeps no shared state while
+  // decoding, so workers can run side by side.
+  void decodeWorker() {
+    for (int layer = nextLayer++; layer < layers; layer = nextLayer++) {
+      Decoded d;
+      d.layer = layer;
+      int nrComponents;
+      // the tomb textures are all RGB; force 3 channels so they share a
+      // format
+      d.data = stbi_load(paths[layer].c_str(), &d.width, &d.height,
+                         &nrComponents, 3);
+      std::lock_guard<std::mutex> lock(decodedMutex);
+      decoded.push_back(d);
+    }
+  }
+
+  void joinWorkers() {
+    for (std::thread &worker : workers)
+      worker.join();
+    workers.clear();
+  }
+
+  // Copy the decoded pixels into the PBO and let the driver pull the layer
+  // from there
+  bool upload(const Decoded &d) {
+    const char *path = paths[d.layer].c_str();
+    if (!d.data) {
+      std::cout << "Texture failed to load at path: " << path << std::endl;
+      return false;
+    }
+    if (d.width != width || d.height != height) {
+      std::cout << "Texture " << path << " is " << d.width << "x" << d.height
+                << ", expected " << width << "x" << height << std::endl;
+      return false;
+    }
+    size_t size = (size_t)width * height * 3;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, PBO);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+    void *dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+                                 GL_MAP_WRITE_BIT |
+                                     GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (dst) {
+      std::memcpy(dst, d.data, size);
+      glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+      glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, d.layer, width, height, 1,
+                      GL_RGB, GL_UNSIGNED_BYTE, (void *)0);
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    return dst != nullptr;
+  }
+
+  void setParameters() {
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER,
+                    GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  }
+
+  // Storage for every layer, filled with a neutral grey placeholder
+  void allocate() {
+    std::vector<unsigned char> grey((size_t)width * height * 3 * layers, 96);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGB8, width, height, layers, 0,
+                 GL_RGB, GL_UNSIGNED_BYTE, grey.data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+  }
+};
+
+#endif
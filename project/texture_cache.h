@@ -0,0 +1,321 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <GL/glew.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Binary cache of a texture array's full mip chain, written on the first run
+// and memory-mapped and uploaded level by level on later runs, so startup
+// neither decodes PNGs nor calls glGenerateMipmap.
+//
+// Layout: TextureCacheHeader, one SourceStamp per layer, then each mip level
+// (largest first) with all layers back to back. Levels are tightly packed
+// RGB8 or BC1 (DXT1) blocks. The stamps record the size and modification
+// time of every source image; if any differs, or the cache is not in the
+// format asked for, it is stale and the caller falls back to decoding.
+class TextureCache {
+public:
+  enum Format : uint32_t { FORMAT_RGB8 = 0, FORMAT_BC1 = 1 };
+
+  // Upload the cached mip chain for sources into the bound
+  // GL_TEXTURE_2D_ARRAY. Returns false, leaving the texture untouched, if the
+  // cache is missing, stale, not BC1 when compress is set (or RGB8 when it
+  // is not) or in a format this GL cannot take.
+  static bool load(const std::string &cachePath,
+                   const std::vector<std::string> &sources, bool compress,
+                   int &width, int &height) {
+    int fd = open(cachePath.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Header)) {
+      close(fd);
+      return false;
+    }
+    size_t fileSize = st.st_size;
+    void *mapped = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+      return false;
+
+    bool ok = upload(static_cast<const unsigned char *>(mapped), fileSize,
+                     sources, compress ? FORMAT_BC1 : FORMAT_RGB8, width,
+                     height);
+    munmap(mapped, fileSize);
+    if (ok)
+      std::cout << "Texture cache: loaded " << cachePath << std::endl;
+    else
+      std::cout << "Texture cache: " << cachePath
+                << " missing or stale, decoding images" << std::endl;
+    return ok;
+  }
+
+  // Read level 0 of the bound GL_TEXTURE_2D_ARRAY back, build the mip chain
+  // on the CPU (BC1-compressing it when compress is set) and write the cache.
+  static bool write(const std::string &cachePath,
+                    const std::vector<std::string> &sources, int width,
+                    int height, bool compress) {
+    int layers = (int)sources.size();
+    std::vector<unsigned char> level((size_t)width * height * 3 * layers);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glGetTexImage(GL_TEXTURE_2D_ARRAY, 0, GL_RGB, GL_UNSIGNED_BYTE,
+                  level.data());
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+    Header header;
+    header.width = width;
+    header.height = height;
+    header.layers = layers;
+    header.levels = levelCount(width, height);
+    header.format = compress ? FORMAT_BC1 : FORMAT_RGB8;
+    std::vector<SourceStamp> stamps(layers);
+    for (int i = 0; i < layers; i++)
+      if (!stampOf(sources[i], stamps[i]))
+        return false;
+
+    std::string tmpPath = cachePath + ".tmp";
+    FILE *file = std::fopen(tmpPath.c_str(), "wb");
+    if (!file)
+      return false;
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+              std::fwrite(stamps.data(), sizeof(SourceStamp), layers, file) ==
+                  (size_t)layers;
+
+    int w = width, h = height;
+    for (uint32_t l = 0; ok && l < header.levels; l++) {
+      if (l > 0) {
+        level = downsample(level, w, h, layers);
+        w = std::max(1, w / 2);
+        h = std::max(1, h / 2);
+      }
+      std::vector<unsigned char> out =
+          compress ? compressBC1(level, w, h, layers) : level;
+      ok = std::fwrite(out.data(), 1, out.size(), file) == out.size();
+    }
+    long written = std::ftell(file);
+    ok = std::fclose(file) == 0 && ok;
+    if (!ok || std::rename(tmpPath.c_str(), cachePath.c_str()) != 0) {
+      std::remove(tmpPath.c_str());
+      return false;
+    }
+    std::cout << "Texture cache: wrote " << cachePath << " ("
+              << written / 1024 << " KB, "
+              << (compress ? "BC1" : "RGB8") << ")" << std::endl;
+    return true;
+  }
+
+private:
+  // larger than any GL texture, so a level's byte size cannot overflow
+  static const uint32_t MAX_DIMENSION = 1 << 16;
+
+  struct Header {
+    char magic[4] = {'T', 'X', 'C', '1'};
+    uint32_t width, height, layers, levels, format;
+  };
+
+  struct SourceStamp {
+    int64_t size;
+    int64_t mtime;
+    bool operator==(const SourceStamp &o) const {
+      return size == o.size && mtime == o.mtime;
+    }
+  };
+
+  static bool stampOf(const std::string &path, SourceStamp &stamp) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+      return false;
+    stamp.size = st.st_size;
+    stamp.mtime = st.st_mtime;
+    return true;
+  }
+
+  static uint32_t levelCount(int width, int height) {
+    uint32_t levels = 1;
+    while (width > 1 || height > 1) {
+      width = std::max(1, width / 2);
+      height = std::max(1, height / 2);
+      levels++;
+    }
+    return levels;
+  }
+
+  static size_t levelSize(uint32_t format, int w, int h, int layers) {
+    if (format == FORMAT_BC1)
+      return (size_t)((w + 3) / 4) * ((h + 3) / 4) * 8 * layers;
+    return (size_t)w * h * 3 * layers;
+  }
+
+  static bool upload(const unsigned char *data, size_t size,
+                     const std::vector<std::string> &sources, uint32_t format,
+                     int &width, int &height) {
+    Header header;
+    const Header *file = reinterpret_cast<const Header *>(data);
+    if (!std::equal(header.magic, header.magic + 4, file->magic) ||
+        file->layers != sources.size() || file->width == 0 ||
+        file->height == 0 || file->width > MAX_DIMENSION ||
+        file->height > MAX_DIMENSION ||
+        file->levels != levelCount(file->width, file->height) ||
+        file->format != format)
+      return false;
+    if (file->format == FORMAT_BC1 && !GLEW_EXT_texture_compression_s3tc)
+      return false;
+
+    // the stamps, then every level, must lie inside the file; each level is
+    // checked against the bytes left so a bad header cannot wrap a sum
+    size_t offset = sizeof(Header) + sources.size() * sizeof(SourceStamp);
+    if (size < offset)
+      return false;
+    const SourceStamp *stamps =
+        reinterpret_cast<const SourceStamp *>(data + sizeof(Header));
+    for (size_t i = 0; i < sources.size(); i++) {
+      SourceStamp stamp;
+      if (!stampOf(sources[i], stamp) || !(stamp == stamps[i]))
+        return false;
+    }
+
+    int w = file->width, h = file->height;
+    size_t left = size - offset;
+    for (uint32_t l = 0; l < file->levels; l++) {
+      size_t bytes = levelSize(file->format, w, h, file->layers);
+      if (bytes > left)
+        return false;
+      left -= bytes;
+      w = std::max(1, w / 2);
+      h = std::max(1, h / 2);
+    }
+
+    width = w = file->width;
+    height = h = file->height;
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (uint32_t l = 0; l < file->levels; l++) {
+      size_t bytes = levelSize(file->format, w, h, file->layers);
+      if (file->format == FORMAT_BC1)
+        glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, l,
+                               GL_COMPRESSED_RGB_S3TC_DXT1_EXT, w, h,
+                               file->layers, 0, bytes, data + offset);
+      else
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, l, GL_RGB8, w, h, file->layers, 0,
+                     GL_RGB, GL_UNSIGNED_BYTE, data + offset);
+      offset += bytes;
+      w = std::max(1, w / 2);
+      h = std::max(1, h / 2);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL,
+                    file->levels - 1);
+    return true;
+  }
+
+  // 2x2 box filter of every layer; odd edges reuse the last row/column
+  static std::vector<unsigned char>
+  downsample(const std::vector<unsigned char> &src, int w, int h,
+             int layers) {
+    int dw = std::max(1, w / 2), dh = std::max(1, h / 2);
+    std::vector<unsigned char> dst((size_t)dw * dh * 3 * layers);
+    for (int layer = 0; layer < layers; layer++) {
+      const unsigned char *in = &src[(size_t)w * h * 3 * layer];
+      unsigned char *out = &dst[(size_t)dw * dh * 3 * layer];
+      for (int y = 0; y < dh; y++) {
+        int y0 = std::min(y * 2, h - 1), y1 = std::min(y * 2 + 1, h - 1);
+        for (int x = 0; x < dw; x++) {
+          int x0 = std::min(x * 2, w - 1), x1 = std::min(x * 2 + 1, w - 1);
+          for (int c = 0; c < 3; c++) {
+            int sum = in[(y0 * w + x0) * 3 + c] + in[(y0 * w + x1) * 3 + c] +
+                      in[(y1 * w + x0) * 3 + c] + in[(y1 * w + x1) * 3 + c];
+            out[(y * dw + x) * 3 + c] = (unsigned char)((sum + 2) / 4);
+          }
+        }
+      }
+    }
+    return dst;
+  }
+
+  static uint16_t to565(const int *rgb) {
+    return (uint16_t)(((rgb[0] * 31 + 127) / 255) << 11 |
+                      ((rgb[1] * 63 + 127) / 255) << 5 |
+                      ((rgb[2] * 31 + 127) / 255));
+  }
+
+  static void from565(uint16_t c, int *rgb) {
+    rgb[0] = ((c >> 11) & 31) * 255 / 31;
+    rgb[1] = ((c >> 5) & 63) * 255 / 63;
+    rgb[2] = (c & 31) * 255 / 31;
+  }
+
+  // BC1 with the colour bounding box as endpoints: 4 bits per texel, an
+  // eighth of the RGBA8 footprint most drivers give GL_RGB8
+  static std::vector<unsigned char>
+  compressBC1(const std::vector<unsigned char> &src, int w, int h,
+              int layers) {
+    int bw = (w + 3) / 4, bh = (h + 3) / 4;
+    std::vector<unsigned char> dst((size_t)bw * bh * 8 * layers);
+    unsigned char *out = dst.data();
+    for (int layer = 0; layer < layers; layer++) {
+      const unsigned char *in = &src[(size_t)w * h * 3 * layer];
+      for (int by = 0; by < bh; by++) {
+        for (int bx = 0; bx < bw; bx++, out += 8) {
+          int texels[16][3];
+          int lo[3] = {255, 255, 255}, hi[3] = {0, 0, 0};
+          for (int i = 0; i < 16; i++) {
+            int x = std::min(bx * 4 + i % 4, w - 1);
+            int y = std::min(by * 4 + i / 4, h - 1);
+            for (int c = 0; c < 3; c++) {
+              texels[i][c] = in[(y * w + x) * 3 + c];
+              lo[c] = std::min(lo[c], texels[i][c]);
+              hi[c] = std::max(hi[c], texels[i][c]);
+            }
+          }
+          uint16_t c0 = to565(hi), c1 = to565(lo);
+          if (c0 < c1)
+            std::swap(c0, c1);
+          // c0 > c1 selects the four-colour mode; equal endpoints mean a
+          // flat block and every index 0
+          int palette[4][3];
+          from565(c0, palette[0]);
+          from565(c1, palette[1]);
+          for (int c = 0; c < 3; c++) {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+          }
+          uint32_t indices = 0;
+          for (int i = 0; c0 != c1 && i < 16; i++) {
+            int best = 0, bestError = 1 << 30;
+            for (int p = 0; p < 4; p++) {
+              int error = 0;
+              for (int c = 0; c < 3; c++) {
+                int d = texels[i][c] - palette[p][c];
+                error += d * d;
+              }
+              if (error < bestError) {
+                bestError = error;
+                best = p;
+              }
+            }
+            indices |= (uint32_t)best << (i * 2);
+          }
+          out[0] = c0 & 0xff;
+          out[1] = c0 >> 8;
+          out[2] = c1 & 0xff;
+          out[3] = c1 >> 8;
+          for (int b = 0; b < 4; b++)
+            out[4 + b] = (indices >> (b * 8)) & 0xff;
+        }
+      }
+    }
+    return dst;
+  }
+};
+
+#endif
@@ -4,21 +4,47 @@ layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
 layout (location = 3) in vec3 aTangent;
 
+// Per-instance data for Cube::drawInstanced (see CubeInstance)
+layout (location = 4) in mat4 aInstanceModel;
+layout (location = 8) in vec2 aInstanceUVScale;
+layout (location = 9) in vec3 aInstanceColor;
+layout (location = 10) in float aInstanceLayer;
+
 out vec3 FragPos;
 out vec2 TexCoords;
 out vec3 Normal;
 out mat3 TBN;
+out vec2 UVScale;
+out vec3 ObjectColor;
+flat out float Layer;
+out float ViewDepth; // for picking the light cluster
 
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
+uniform bool useInstancing;
+uniform vec2 uvScale;
+uniform vec3 objectColor;
+uniform float textureLayer;
+
 void main()
 {
-    FragPos = vec3(model * vec4(aPos, 1.0));
+    mat4 M = model;
+    UVScale = uvScale;
+    ObjectColor = objectColor;
+    Layer = textureLayer;
+    if (useInstancing) {
+        M = aInstanceModel;
+        UVScale = aInstanceUVScale;
+        ObjectColor = aInstanceColor;
+        Layer = aInstanceLayer;
+    }
+
+    FragPos = vec3(M * vec4(aPos, 1.0));
     TexCoords = aTexCoords;
     
-    mat3 normalMatrix = transpose(inverse(mat3(model)));
+    mat3 normalMatrix = transpose(inverse(mat3(M)));
     Normal = normalMatrix * aNormal;
     
     vec3 T = normalize(normalMatrix * aTangent);
@@ -28,5 +54,7 @@ void main()
     
     TBN = mat3(T, B, N);
     
-    gl_Position = projection * view * vec4(FragPos, 1.0);
+    vec4 viewPos = view * vec4(FragPos, 1.0);
+    ViewDepth = -viewPos.z;
+    gl_Position = projection * viewPos;
 }
\ No newline at end of file